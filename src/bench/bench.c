@@ -0,0 +1,507 @@
+// headless benchmark. paints synthetic strokes offscreen across texture sizes,
+// brush radii, layer counts and meshes, and writes one json object per line:
+// a "frame" object per painted frame and a "run" object per configuration.
+//
+// usage: dali-bench [-s sizes] [-r radii] [-l layer counts]
+//                   [-c resident layer counts] [-m meshes] [-n strokes]
+//                   [-f frames per stroke] [-d data dir] [-p recording]
+//                   [-o output, - for stdout]
+// lists are comma separated, e.g. -s 4096,8192 -r 0.01,0.05 -m pig,grid
+//
+// each frame object has the device time of every stage in gpu_ms. those are
+// read back a few frames late, so gpu_frame says which frame they belong to.
+// the run object's memory is what was actually allocated: engine_bytes is
+// the most device memory the engine held at once, layer_bytes and undo_bytes
+// are the host tiles of the stack and of the undo history.
+//
+// by default 4 layers are also run with only 2 of them resident, so the
+// strokes moving between layers evict copies and upload them again. the run
+// object counts those uploads.
+//
+// -p replays a session recorded with paint -r instead of the synthetic
+// strokes, once per mesh given. its texture size, brush and layers are the
+// recorded ones, and the mesh has to be the one it was painted on. it keeps
+// as many layers resident as the first resident count says. its frame
+// objects give the radius the brush had, and its run object none.
+//
+// nothing is presented, so any vulkan implementation with ray tracing
+// pipelines will do, software ones included. point VK_ICD_FILENAMES at its
+// icd json to pick it.
+#include "dali.h"
+#include <hell/common.h>
+#include <hell/len.h>
+#include <hell/minmax.h>
+#include <obsidian/obsidian.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef UNIX
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#define MAX_VALUES 8
+
+#define MIB ((VkDeviceSize)1 << 20)
+
+typedef struct Values {
+    uint32_t count;
+    double   v[MAX_VALUES];
+} Values;
+
+typedef struct Config {
+    uint32_t     texSize;
+    float        radius;
+    uint32_t     layerCount;
+    uint32_t     residentCount;
+    const char*  mesh;
+    Dali_Replay* replay; // drives the brush instead of the strokes if set
+} Config;
+
+static const char* meshNames[] = {"pig", "flip-uv", "grid"};
+static const char* meshFiles[] = {"pig.tnt", "flip-uv.tnt", "grid.tnt"};
+
+static Values      sizes       = {3, {4096, 8192, 16384}};
+static Values      radii       = {2, {0.01, 0.05}};
+static Values      layerCounts = {2, {1, 4}};
+static Values      residentCounts = {2, {2, 4}};
+static bool        meshEnabled[LEN(meshNames)] = {true, true, true};
+static uint32_t    strokeCount     = 8;
+static uint32_t    framesPerStroke = 30;
+static const char* dataDir         = "../data";
+static const char* outPath         = "dali-bench.jsonl";
+static const char* replayPath;
+
+static FILE*          out;
+static Obdn_Instance* oInstance;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static bool
+parseValues(const char* arg, Values* values)
+{
+    char  buf[256];
+    char* save;
+    snprintf(buf, sizeof(buf), "%s", arg);
+    values->count = 0;
+    for (char* tok = strtok_r(buf, ",", &save); tok;
+         tok       = strtok_r(NULL, ",", &save))
+    {
+        if (values->count == MAX_VALUES)
+            return false;
+        values->v[values->count++] = atof(tok);
+    }
+    return values->count > 0;
+}
+
+static bool
+parseMeshes(const char* arg)
+{
+    char  buf[256];
+    char* save;
+    snprintf(buf, sizeof(buf), "%s", arg);
+    memset(meshEnabled, 0, sizeof(meshEnabled));
+    for (char* tok = strtok_r(buf, ",", &save); tok;
+         tok       = strtok_r(NULL, ",", &save))
+    {
+        bool found = false;
+        for (int i = 0; i < LEN(meshNames); i++)
+        {
+            if (strcmp(tok, meshNames[i]) == 0)
+                meshEnabled[i] = found = true;
+        }
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+static int
+compareDoubles(const void* a, const void* b)
+{
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static long
+peakRssKiB(void)
+{
+#ifdef UNIX
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#else
+    return 0;
+#endif
+}
+
+// a stroke sweeps across the middle of the view along a lissajous curve, each
+// one offset from the last so they cover different tiles
+static void
+strokePos(const uint32_t stroke, const uint32_t frame, float* x, float* y)
+{
+    const float t     = (float)frame / framesPerStroke;
+    const float phase = stroke * 0.7f;
+    *x = 0.5f + 0.3f * cosf(phase) * (2.0f * t - 1.0f);
+    *y = 0.5f + 0.2f * sinf(2.0f * 3.14159265f * t + phase);
+}
+
+static void
+runConfig(const Config* cfg)
+{
+    const VkDeviceSize texMiB =
+        DALI_TEXSIZE((VkDeviceSize)cfg->texSize, 1, 4) / MIB;
+
+    // the engine's images as it bounds them, which counts the resident
+    // layers and the flat images, its staging buffer, which grows to a
+    // layer, and room for the tiles the strokes touch on every layer
+    const VkDeviceSize imageMiB =
+        dali_GetEngineImageMemoryBound(oInstance, cfg->texSize,
+                                       cfg->residentCount) / MIB;
+    Obdn_Memory* memory = obdn_AllocMemory();
+    obdn_CreateMemory(oInstance, 512 + texMiB * cfg->layerCount / 4,
+                      256 + texMiB, imageMiB + 256, 1024, 0, memory);
+
+    Obdn_Scene* scene = obdn_AllocScene();
+    obdn_CreateScene(NULL, memory, 0.01, 100, scene);
+
+    Dali_Engine*      engine = dali_AllocEngine();
+    Dali_LayerStack*  stack  = dali_AllocLayerStack();
+    Dali_Brush*       brush  = dali_AllocBrush();
+    Dali_UndoManager* undo   = dali_AllocUndo();
+
+    dali_CreateLayerStack(memory, cfg->texSize, stack);
+    dali_CreateUndoManager(stack, (VkDeviceSize)256 << 20, NULL, 0, undo);
+    dali_CreateBrush(NULL, brush);
+    dali_SetBrushRadius(brush, cfg->radius);
+    for (uint32_t i = 1; i < cfg->layerCount; i++)
+        dali_CreateLayer(stack);
+    dali_CreateEngine(oInstance, memory, undo, scene, brush, cfg->texSize,
+                      NULL, engine);
+    dali_SetResidentLayerCount(engine, cfg->residentCount);
+
+    char path[512];
+    for (int i = 0; i < LEN(meshNames); i++)
+        if (strcmp(cfg->mesh, meshNames[i]) == 0)
+            snprintf(path, sizeof(path), "%s/%s", dataDir, meshFiles[i]);
+    Obdn_PrimitiveHandle prim = obdn_LoadPrim(scene, path, COAL_MAT4_IDENT,
+                                              dali_GetPaintMaterial(engine));
+    dali_SetActivePrim(engine, prim);
+
+    const VkDevice device = obdn_GetDevice(oInstance);
+    Obdn_Command   commands[DALI_FRAMES_IN_FLIGHT];
+    for (int i = 0; i < DALI_FRAMES_IN_FLIGHT; i++)
+        commands[i] = obdn_CreateCommand(oInstance, OBDN_V_QUEUE_GRAPHICS_TYPE);
+
+    if (cfg->replay)
+        dali_SeedEngine(engine, dali_GetReplaySeed(cfg->replay));
+
+    // a replay's length is only known once it runs out
+    uint32_t frameCount    = cfg->replay ? 0 : strokeCount * framesPerStroke;
+    uint32_t frameCapacity = cfg->replay ? 1024 : frameCount;
+    double*  frameMs       = calloc(frameCapacity, sizeof(double));
+    double   prevStart     = now();
+    const double runStart  = prevStart;
+
+    // the most device memory the engine held at once
+    VkDeviceSize engineBytes = 0;
+
+    for (uint32_t f = 0; cfg->replay || f < frameCount; f++)
+    {
+        const uint32_t stroke = f / framesPerStroke;
+        const uint32_t step   = f % framesPerStroke;
+
+        if (cfg->replay)
+        {
+            if (!dali_ReplayFrame(cfg->replay, scene, brush, stack, undo, NULL))
+                break;
+            if (f == frameCapacity)
+            {
+                frameCapacity *= 2;
+                frameMs = realloc(frameMs, frameCapacity * sizeof(double));
+            }
+            frameCount = f + 1;
+        }
+        else
+        {
+            // move to the next layer between strokes, so layer changes are
+            // part of the measurement whenever there is more than one
+            if (step == 0 && stroke > 0 && cfg->layerCount > 1)
+                dali_SetActiveLayer(stack, stroke % cfg->layerCount);
+
+            float x, y;
+            strokePos(stroke, step, &x, &y);
+            dali_SetBrushPos(brush, x, y);
+            if (step == 0)
+                dali_SetBrushActive(brush);
+            if (step == framesPerStroke - 1)
+            {
+                dali_SetBrushInactive(brush);
+                dali_BackupLayer(stack);
+            }
+        }
+
+        Obdn_Command* cmd = &commands[f % DALI_FRAMES_IN_FLIGHT];
+        obdn_WaitForFence(device, &cmd->fence);
+
+        const double start = now();
+        obdn_ResetCommand(cmd);
+        obdn_BeginCommandBuffer(cmd->buffer);
+        const Dali_PaintTimeline timeline =
+            dali_Paint(engine, scene, brush, stack, undo, cmd->buffer);
+        obdn_EndCommandBuffer(cmd->buffer);
+        const double recordMs = now() - start;
+
+        obdn_SceneClearDirt(scene);
+        dali_LayerStackClearDirt(stack);
+        dali_UndoClearDirt(undo);
+        dali_BrushClearDirt(brush);
+
+        const VkPipelineStageFlags waitStage =
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        const bool waits = timeline.waitValue != 0;
+        const VkTimelineSemaphoreSubmitInfo values = {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount   = waits ? 1 : 0,
+            .pWaitSemaphoreValues      = &timeline.waitValue,
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues    = &timeline.signalValue};
+        const VkSubmitInfo submit = {
+            .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext                = &values,
+            .waitSemaphoreCount   = waits ? 1 : 0,
+            .pWaitSemaphores      = &timeline.semaphore,
+            .pWaitDstStageMask    = &waitStage,
+            .commandBufferCount   = 1,
+            .pCommandBuffers      = &cmd->buffer,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores    = &timeline.semaphore};
+        obdn_SubmitGraphicsCommands(oInstance, 0, 1, &submit, cmd->fence);
+
+        // frames overlap, so the time between frame starts is what a frame
+        // costs once the pipeline is full
+        frameMs[f] = start - prevStart;
+        prevStart  = start;
+
+        engineBytes = MAX(engineBytes, dali_GetEngineMemoryUsage(engine));
+
+        // the device times dali_Paint read back are those of the paint stages
+        // of the frame DALI_FRAMES_IN_FLIGHT before this one, see gpu_frame.
+        // a replay sets the radius itself, so it is the brush's
+        fprintf(out,
+                "{\"type\":\"frame\",\"texsize\":%u,\"radius\":%g,"
+                "\"layers\":%d,\"resident\":%u,\"mesh\":\"%s\",\"frame\":%u,"
+                "\"stroke\":%d,\"record_ms\":%.4f,\"frame_ms\":%.4f,"
+                "\"gpu_frame\":%d,\"gpu_ms\":{",
+                cfg->texSize, dali_GetBrushRadius(brush),
+                dali_GetLayerCount(stack), cfg->residentCount, cfg->mesh, f,
+                cfg->replay ? -1 : (int)stroke, recordMs, frameMs[f],
+                (int)f - DALI_FRAMES_IN_FLIGHT);
+        for (int s = 0; s < DALI_STAGE_COUNT; s++)
+            fprintf(out, "%s\"%s\":%.4f", s ? "," : "", dali_GetStageName(s),
+                    dali_GetFrameStageTime(engine, s));
+        fprintf(out, "}}\n");
+    }
+
+    V_ASSERT(vkDeviceWaitIdle(device));
+    const double totalMs = now() - runStart;
+
+    // the first frame is skipped, it only measures the setup before the loop
+    const uint32_t n = frameCount > 1 ? frameCount - 1 : 0;
+    qsort(frameMs + 1, n, sizeof(double), compareDoubles);
+    double sum = 0;
+    for (uint32_t f = 1; f <= n; f++)
+        sum += frameMs[f];
+    const double   avg = n ? sum / n : 0;
+    const double   p99 = n ? frameMs[1 + (99 * n + 99) / 100 - 1] : 0;
+
+    // a replay's radius is whatever the recording set it to frame by frame,
+    // so its run has none
+    fprintf(out, "{\"type\":\"run\",\"texsize\":%u,", cfg->texSize);
+    if (!cfg->replay)
+        fprintf(out, "\"radius\":%g,", cfg->radius);
+    fprintf(out,
+            "\"layers\":%d,\"resident\":%u,\"mesh\":\"%s\",\"replay\":%s,"
+            "\"frames\":%u,\"total_ms\":%.3f,\"frame_avg_ms\":%.4f,"
+            "\"frame_p99_ms\":%.4f,"
+            "\"uploads\":%llu,\"engine_bytes\":%llu,\"layer_bytes\":%llu,"
+            "\"undo_bytes\":%llu,\"peak_rss_kib\":%ld,\"stages\":{",
+            dali_GetLayerCount(stack), cfg->residentCount, cfg->mesh,
+            cfg->replay ? "true" : "false", frameCount, totalMs, avg, p99,
+            (unsigned long long)dali_GetLayerUploadCount(engine),
+            (unsigned long long)engineBytes,
+            (unsigned long long)dali_GetLayerStackMemoryUsage(stack),
+            (unsigned long long)dali_GetUndoMemoryUsage(undo), peakRssKiB());
+    for (int s = 0; s < DALI_STAGE_COUNT; s++)
+    {
+        Dali_StageTiming t;
+        dali_GetStageTiming(engine, s, &t);
+        fprintf(out,
+                "%s\"%s\":{\"samples\":%u,\"min_ms\":%.4f,\"avg_ms\":%.4f,"
+                "\"p99_ms\":%.4f}",
+                s ? "," : "", dali_GetStageName(s), t.samples, t.min, t.avg,
+                t.p99);
+    }
+    fprintf(out, "}}\n");
+    fflush(out);
+
+    free(frameMs);
+    for (int i = 0; i < DALI_FRAMES_IN_FLIGHT; i++)
+        obdn_DestroyCommand(commands[i]);
+    dali_DestroyEngine(engine);
+    // the history's tiles come from the stack
+    dali_DestroyUndoManager(undo);
+    dali_DestroyLayerStack(stack);
+    obdn_DestroyScene(scene);
+    obdn_DestroyMemory(memory);
+    hell_Free(engine);
+    hell_Free(stack);
+    hell_Free(brush);
+    hell_Free(undo);
+    hell_Free(scene);
+    hell_Free(memory);
+}
+
+// every resident count from the layer count up keeps all of the layers
+// resident, so only the first of them is run
+static bool
+residentCountRepeats(const uint32_t index, const uint32_t layerCount)
+{
+    const uint32_t count = MIN(residentCounts.v[index], layerCount);
+    for (uint32_t i = 0; i < index; i++)
+    {
+        if (MIN(residentCounts.v[i], layerCount) == count)
+            return true;
+    }
+    return false;
+}
+
+static void
+runMatrix(void)
+{
+    for (uint32_t s = 0; s < sizes.count; s++)
+        for (uint32_t r = 0; r < radii.count; r++)
+            for (uint32_t l = 0; l < layerCounts.count; l++)
+                for (uint32_t c = 0; c < residentCounts.count; c++)
+                    for (int m = 0; m < LEN(meshNames); m++)
+                    {
+                        const uint32_t layerCount = layerCounts.v[l];
+                        if (!meshEnabled[m] ||
+                            residentCountRepeats(c, layerCount))
+                            continue;
+                        const Config cfg = {
+                            .texSize       = sizes.v[s],
+                            .radius        = radii.v[r],
+                            .layerCount    = layerCount,
+                            .residentCount = residentCounts.v[c],
+                            .mesh          = meshNames[m]};
+                        runConfig(&cfg);
+                    }
+}
+
+// returns false if the recording could not be read
+static bool
+runReplays(void)
+{
+    for (int m = 0; m < LEN(meshNames); m++)
+    {
+        if (!meshEnabled[m])
+            continue;
+        Dali_Replay* replay = dali_AllocReplay();
+        if (!dali_CreateReplay(replayPath, replay))
+        {
+            hell_Free(replay);
+            return false;
+        }
+        const Config cfg = {.texSize       = dali_GetReplayTextureSize(replay),
+                            .layerCount    = 1, // the replay adds the rest
+                            .residentCount = residentCounts.v[0],
+                            .mesh          = meshNames[m],
+                            .replay        = replay};
+        runConfig(&cfg);
+        dali_DestroyReplay(replay);
+        hell_Free(replay);
+    }
+    return true;
+}
+
+static void
+usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [-s sizes] [-r radii] [-l layer counts]\n"
+            "          [-c resident layer counts] [-m meshes] [-n strokes]\n"
+            "          [-f frames per stroke] [-d data dir] [-p recording]\n"
+            "          [-o output, - for stdout]\n"
+            "meshes are any of pig, flip-uv and grid\n",
+            name);
+}
+
+#ifdef UNIX
+int
+main(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:l:c:m:n:f:d:p:o:h")) != -1)
+    {
+        bool ok = true;
+        switch (opt)
+        {
+        case 's': ok = parseValues(optarg, &sizes); break;
+        case 'r': ok = parseValues(optarg, &radii); break;
+        case 'l': ok = parseValues(optarg, &layerCounts); break;
+        case 'c': ok = parseValues(optarg, &residentCounts); break;
+        case 'm': ok = parseMeshes(optarg); break;
+        case 'n': ok = (strokeCount = atoi(optarg)) > 0; break;
+        case 'f': ok = (framesPerStroke = atoi(optarg)) > 1; break;
+        case 'd': dataDir = optarg; break;
+        case 'p': replayPath = optarg; break;
+        case 'o': outPath = optarg; break;
+        default: ok = false; break;
+        }
+        if (!ok)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for (uint32_t i = 0; i < sizes.count; i++)
+    {
+        const uint32_t size = sizes.v[i];
+        if (size == 0 || size % 256 != 0)
+        {
+            fprintf(stderr, "texture sizes must be multiples of 256\n");
+            return 1;
+        }
+    }
+
+    out = strcmp(outPath, "-") == 0 ? stdout : fopen(outPath, "w");
+    if (!out)
+    {
+        perror(outPath);
+        return 1;
+    }
+
+    // no swapchain, so no window or surface extensions either
+    oInstance = obdn_AllocInstance();
+    obdn_CreateInstance(false, true, 0, NULL, oInstance);
+
+    const bool ok = replayPath ? runReplays() : (runMatrix(), true);
+
+    obdn_DestroyInstance(oInstance);
+    hell_Free(oInstance);
+    if (out != stdout)
+        fclose(out);
+    return ok ? 0 : 1;
+}
+#endif
@@ -8,7 +8,14 @@
 #include <shiv/shiv.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#ifdef UNIX
 #include <unistd.h>
+#include <poll.h>
+#include <xcb/xcb.h>
+#elif defined(WINDOWS)
+#include <windows.h>
+#endif
 
 Hell_EventQueue* eventQueue;
 Hell_Grimoire*   grimoire;
@@ -29,8 +36,13 @@ Dali_Brush*       brush;
 
 Shiv_Renderer* renderer;
 
-Obdn_Command renderCommand;
-Obdn_Command paintCommand;
+// every painted frame is written here if a path is given
+Dali_Recorder* recorder;
+const char*    recordPath;
+
+// one of each per frame in flight
+Obdn_Command renderCommands[DALI_FRAMES_IN_FLIGHT];
+Obdn_Command paintCommands[DALI_FRAMES_IN_FLIGHT];
 
 #define WWIDTH 888
 #define WHEIGHT 888
@@ -39,6 +51,7 @@ static int windowWidth  = WWIDTH;
 static int windowHeight = WHEIGHT;
 
 static bool spaceDown = false;
+static bool redraw    = true; // the window needs a frame regardless of paint
 
 struct SceneMemEng {
     Obdn_Scene* scene;
@@ -77,6 +90,14 @@ handleKeyEvent(const Hell_Event* ev, void* data)
     {
         spaceDown = !spaceDown;
     }
+    if (code == HELL_KEY_Z && ev->type == HELL_EVENT_TYPE_KEYDOWN)
+    {
+        dali_Undo(undoManager);
+    }
+    if (code == HELL_KEY_R && ev->type == HELL_EVENT_TYPE_KEYDOWN)
+    {
+        dali_Redo(undoManager);
+    }
     return false;
 }
 
@@ -86,6 +107,7 @@ handleWindowResizeEvent(const Hell_Event* ev, void* data)
     if (ev->type != HELL_EVENT_TYPE_RESIZE) return false;
     windowWidth = ev->data.winData.data.resizeData.width;
     windowHeight = ev->data.winData.data.resizeData.height;
+    redraw = true;
     return false;
 }
 
@@ -166,6 +188,7 @@ handlePaintEvent(const Hell_Event* ev, void* data)
     if (ev->type == HELL_EVENT_TYPE_MOUSEUP)
     {
         dali_SetBrushInactive(brush);
+        dali_BackupLayer(layerStack);
     }
     return false;
 }
@@ -179,43 +202,107 @@ handleMouseEvent(const Hell_Event* ev, void* data)
 }
 
 #define TARGET_RENDER_INTERVAL 10000 // render every 30 ms
+#define PENDING_WORK_INTERVAL 2 // ms to wait for input while the engine has work to finish
+
+static VkSemaphore acquireSemaphores[DALI_FRAMES_IN_FLIGHT];
+static uint32_t    frameIndex;
 
-static VkSemaphore acquireSemaphore;
+// blocks until the window has input for hell to read, or for at most timeout
+// ms. a negative timeout waits for input alone.
+static void
+waitForInput(int timeout)
+{
+#ifdef UNIX
+    struct pollfd fd = {
+        .fd     = xcb_get_file_descriptor(
+            (xcb_connection_t*)hell_GetXcbConnection(window)),
+        .events = POLLIN};
+    poll(&fd, 1, timeout);
+#elif defined(WINDOWS)
+    MsgWaitForMultipleObjects(0, NULL, FALSE, timeout < 0 ? INFINITE : timeout,
+                              QS_ALLINPUT);
+#endif
+}
+
+// nothing to paint: sleep until there is input, waking early only while the
+// engine still has work to finish once the device is done with it
+static void
+idle(void)
+{
+    if (!dali_HasPendingWork(engine))
+    {
+        waitForInput(-1);
+        return;
+    }
+    waitForInput(PENDING_WORK_INTERVAL);
+    dali_FinishPendingWork(engine, layerStack);
+}
 
 void
 daliFrame(void)
 {
-    obdn_WaitForFence(obdn_GetDevice(oInstance), &paintCommand.fence);
+    if (!redraw && !dali_NeedsPaint(engine, scene, brush, layerStack, undoManager))
+    {
+        // leave the gpu idle. hell reads the input once we return
+        idle();
+        return;
+    }
+    redraw = false;
+
+    Obdn_Command* paintCommand     = &paintCommands[frameIndex];
+    Obdn_Command* renderCommand    = &renderCommands[frameIndex];
+    VkSemaphore*  acquireSemaphore = &acquireSemaphores[frameIndex];
+    frameIndex = (frameIndex + 1) % DALI_FRAMES_IN_FLIGHT;
+
+    // only the frame recorded DALI_FRAMES_IN_FLIGHT ago has to be done
+    obdn_WaitForFence(obdn_GetDevice(oInstance), &paintCommand->fence);
 
     VkFence                 fence = VK_NULL_HANDLE;
     const Obdn_Framebuffer* fb =
-        obdn_AcquireSwapchainFramebuffer(swapchain, &fence, &acquireSemaphore);
+        obdn_AcquireSwapchainFramebuffer(swapchain, &fence, acquireSemaphore);
 
-    VkSemaphore undoWaitSemaphore = VK_NULL_HANDLE;
-    obdn_ResetCommand(&paintCommand);
-    obdn_BeginCommandBuffer(paintCommand.buffer);
-    undoWaitSemaphore = dali_Paint(engine, scene, brush, layerStack, undoManager, paintCommand.buffer);
-    obdn_EndCommandBuffer(paintCommand.buffer);
+    obdn_ResetCommand(paintCommand);
+    obdn_BeginCommandBuffer(paintCommand->buffer);
+    if (recorder)
+        dali_RecordFrame(recorder, scene, brush, layerStack, undoManager);
+    const Dali_PaintTimeline paintTimeline = dali_Paint(engine, scene, brush, layerStack, undoManager, paintCommand->buffer);
+    obdn_EndCommandBuffer(paintCommand->buffer);
 
-    obdn_ResetCommand(&renderCommand);
-    obdn_BeginCommandBuffer(renderCommand.buffer);
-    shiv_Render(renderer, scene, fb, renderCommand.buffer);
-    obdn_EndCommandBuffer(renderCommand.buffer);
+    obdn_ResetCommand(renderCommand);
+    obdn_BeginCommandBuffer(renderCommand->buffer);
+    shiv_Render(renderer, scene, fb, renderCommand->buffer);
+    obdn_EndCommandBuffer(renderCommand->buffer);
 
     obdn_SceneClearDirt(scene);
     dali_LayerStackClearDirt(layerStack);
+    dali_UndoClearDirt(undoManager);
+    dali_BrushClearDirt(brush);
 
-    VkPipelineStageFlags stageFlags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    // undo restores imageB, which paint reads from the fragment stage on
+    VkPipelineStageFlags stageFlags = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     VkPipelineStageFlags renderStageFlags = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    // the render waits on the binary semaphore, the engine on the timeline.
+    // the binary semaphore's value is ignored.
+    const bool     paintWaits     = paintTimeline.waitValue != 0;
+    VkSemaphore    paintSignals[] = {paintCommand->semaphore, paintTimeline.semaphore};
+    const uint64_t signalValues[] = {0, paintTimeline.signalValue};
+    VkTimelineSemaphoreSubmitInfo paintValues = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = paintWaits ? 1 : 0,
+        .pWaitSemaphoreValues = &paintTimeline.waitValue,
+        .signalSemaphoreValueCount = LEN(signalValues),
+        .pSignalSemaphoreValues = signalValues,
+    };
     VkSubmitInfo paintSubmit = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &paintValues,
         .commandBufferCount = 1,
-        .waitSemaphoreCount = undoWaitSemaphore == VK_NULL_HANDLE ? 0 : 1,
-        .signalSemaphoreCount = 1,
+        .waitSemaphoreCount = paintWaits ? 1 : 0,
+        .signalSemaphoreCount = LEN(paintSignals),
         .pWaitDstStageMask = &stageFlags,
-        .pSignalSemaphores = &paintCommand.semaphore,
-        .pWaitSemaphores = &undoWaitSemaphore,
-        .pCommandBuffers = &paintCommand.buffer,
+        .pSignalSemaphores = paintSignals,
+        .pWaitSemaphores = &paintTimeline.semaphore,
+        .pCommandBuffers = &paintCommand->buffer,
     };
     VkSubmitInfo renderSubmit = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
@@ -223,13 +310,13 @@ daliFrame(void)
         .waitSemaphoreCount = 1,
         .signalSemaphoreCount = 1,
         .pWaitDstStageMask = &renderStageFlags,
-        .pSignalSemaphores = &renderCommand.semaphore,
-        .pWaitSemaphores = &paintCommand.semaphore,
-        .pCommandBuffers = &renderCommand.buffer,
+        .pSignalSemaphores = &renderCommand->semaphore,
+        .pWaitSemaphores = &paintCommand->semaphore,
+        .pCommandBuffers = &renderCommand->buffer,
     };
     VkSubmitInfo submitinfos[] = {paintSubmit, renderSubmit};
-    obdn_SubmitGraphicsCommands(oInstance, 0, LEN(submitinfos), submitinfos, paintCommand.fence);
-    VkSemaphore waitSemas[] = {acquireSemaphore, renderCommand.semaphore};
+    obdn_SubmitGraphicsCommands(oInstance, 0, LEN(submitinfos), submitinfos, paintCommand->fence);
+    VkSemaphore waitSemas[] = {*acquireSemaphore, renderCommand->semaphore};
     obdn_PresentFrame(swapchain, LEN(waitSemas), waitSemas);
 }
 
@@ -270,20 +357,38 @@ painterMain(const char* gmod)
     brush       = dali_AllocBrush();
     undoManager = dali_AllocUndo();
 
-    u64 texSize = DALI_TEXSIZE(4096, 1, 4);
-    dali_CreateUndoManager(oMemory, texSize, 4, 4, undoManager);
+    dali_CreateLayerStack(oMemory, 4096, layerStack);
+    // 256 MiB of history in memory, up to 2 GiB more on disk
+    dali_CreateUndoManager(layerStack, (VkDeviceSize)256 << 20,
+                           "dali-undo.swap", (VkDeviceSize)2 << 30, undoManager);
     dali_CreateBrush(grimoire, brush);
     dali_SetBrushRadius(brush, 0.01);
-    dali_CreateLayerStack(oMemory, texSize, layerStack);
     dali_CreateEngine(oInstance, oMemory, undoManager, scene,
                               brush, 4096, grimoire, engine);
 
+    if (recordPath)
+    {
+        // a fresh seed per session, replays read it back from the recording
+        const uint64_t seed = (uint64_t)time(NULL);
+        recorder = dali_AllocRecorder();
+        if (dali_CreateRecorder(recordPath, seed, layerStack, recorder))
+            dali_SeedEngine(engine, seed);
+        else
+        {
+            hell_Free(recorder);
+            recorder = NULL;
+        }
+    }
+
     Obdn_PrimitiveHandle prim = obdn_LoadPrim(scene, "../data/pig.tnt", COAL_MAT4_IDENT, dali_GetPaintMaterial(engine));
     dali_SetActivePrim(engine, prim);
 
-    obdn_CreateSemaphore(obdn_GetDevice(oInstance), &acquireSemaphore);
-    paintCommand = obdn_CreateCommand(oInstance, OBDN_V_QUEUE_GRAPHICS_TYPE);
-    renderCommand = obdn_CreateCommand(oInstance, OBDN_V_QUEUE_GRAPHICS_TYPE);
+    for (int i = 0; i < DALI_FRAMES_IN_FLIGHT; i++)
+    {
+        obdn_CreateSemaphore(obdn_GetDevice(oInstance), &acquireSemaphores[i]);
+        paintCommands[i]  = obdn_CreateCommand(oInstance, OBDN_V_QUEUE_GRAPHICS_TYPE);
+        renderCommands[i] = obdn_CreateCommand(oInstance, OBDN_V_QUEUE_GRAPHICS_TYPE);
+    }
     renderer = shiv_AllocRenderer();
     shiv_CreateRenderer(oInstance, oMemory, grimoire,
                         VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
@@ -309,8 +414,15 @@ painterMain(const char* gmod)
 int
 main(int argc, char* argv[])
 {
-    if (argc > 1)
-        painterMain(argv[1]);
+    // -r <file> records the session for replay with dali-bench -p <file>
+    int opt;
+    while ((opt = getopt(argc, argv, "r:")) != -1)
+    {
+        if (opt == 'r')
+            recordPath = optarg;
+    }
+    if (optind < argc)
+        painterMain(argv[optind]);
     else
         painterMain("standalone");
 }
@@ -0,0 +1,296 @@
+#include "accel.h"
+#include "dtags.h"
+#include <hell/common.h>
+#include <hell/debug.h>
+#include <obsidian/command.h>
+#include <obsidian/memory.h>
+#include <obsidian/video.h>
+#include <stdlib.h>
+#include <string.h>
+
+// spec minimum for the offset of a structure within its buffer
+#define AS_OFFSET_ALIGNMENT 256
+
+#define BLAS_FLAGS                                                             \
+    (VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR |                    \
+     VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR |                \
+     VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR)
+
+typedef Obdn_R_AccelerationStructure AccelerationStructure;
+
+// the geometry and build info of one blas. the info points at the geometry,
+// so these must not move once filled.
+typedef struct BuildInput {
+    VkAccelerationStructureGeometryKHR          geometry;
+    VkAccelerationStructureBuildRangeInfoKHR    range;
+    VkAccelerationStructureBuildGeometryInfoKHR info;
+    VkAccelerationStructureBuildSizesInfoKHR    sizes;
+    Obdn_V_BufferRegion                         scratch;
+} BuildInput;
+
+static VkDeviceSize
+alignUp(const VkDeviceSize x, const VkDeviceSize alignment)
+{
+    return (x + alignment - 1) / alignment * alignment;
+}
+
+static VkDeviceAddress
+bufferAddress(VkDevice device, const VkBuffer buffer)
+{
+    const VkBufferDeviceAddressInfo info = {
+        .sType  = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .buffer = buffer};
+    return vkGetBufferDeviceAddress(device, &info);
+}
+
+static VkDeviceAddress
+regionAddress(VkDevice device, const Obdn_V_BufferRegion* region)
+{
+    return bufferAddress(device, region->buffer) + region->offset;
+}
+
+static uint32_t
+scratchAlignment(const Obdn_Instance* instance)
+{
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR asProps = {
+        .sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR};
+    VkPhysicalDeviceProperties2 props = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &asProps};
+    vkGetPhysicalDeviceProperties2(obdn_GetPhysicalDevice(instance), &props);
+    return asProps.minAccelerationStructureScratchOffsetAlignment;
+}
+
+static void
+fillBuildInput(VkDevice device, const Obdn_Geometry* geo,
+               const VkBuildAccelerationStructureModeKHR mode,
+               BuildInput*                               input)
+{
+    memset(input, 0, sizeof(BuildInput));
+
+    input->geometry = (VkAccelerationStructureGeometryKHR){
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+        .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+        .flags        = VK_GEOMETRY_OPAQUE_BIT_KHR,
+        .geometry.triangles = {
+            .sType =
+                VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+            .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+            .vertexData.deviceAddress =
+                bufferAddress(device, geo->vertexRegion.buffer) +
+                obdn_GetAttrOffset(geo, "pos"),
+            .vertexStride            = sizeof(float) * 3,
+            .maxVertex               = geo->vertexCount - 1,
+            .indexType               = VK_INDEX_TYPE_UINT32,
+            .indexData.deviceAddress = regionAddress(device, &geo->indexRegion)}};
+
+    input->range = (VkAccelerationStructureBuildRangeInfoKHR){
+        .primitiveCount = geo->indexCount / 3};
+
+    input->info = (VkAccelerationStructureBuildGeometryInfoKHR){
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .type  = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        .flags = BLAS_FLAGS,
+        .mode  = mode,
+        .geometryCount = 1,
+        .pGeometries   = &input->geometry};
+
+    input->sizes = (VkAccelerationStructureBuildSizesInfoKHR){
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+    vkGetAccelerationStructureBuildSizesKHR(
+        device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &input->info,
+        &input->range.primitiveCount, &input->sizes);
+}
+
+static void
+allocScratch(VkDevice device, Obdn_Memory* memory, const VkDeviceSize size,
+             const uint32_t alignment, BuildInput* input)
+{
+    input->scratch = obdn_RequestBufferRegion(
+        memory, size + alignment,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        OBDN_V_MEMORY_DEVICE_TYPE);
+    input->info.scratchData.deviceAddress =
+        alignUp(regionAddress(device, &input->scratch), alignment);
+}
+
+static void
+createStructure(VkDevice device, Obdn_Memory* memory, const VkDeviceSize size,
+                AccelerationStructure* as)
+{
+    as->bufferRegion = obdn_RequestBufferRegion(
+        memory, size + AS_OFFSET_ALIGNMENT,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        OBDN_V_MEMORY_DEVICE_TYPE);
+
+    const VkAccelerationStructureCreateInfoKHR info = {
+        .sType  = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+        .buffer = as->bufferRegion.buffer,
+        .offset = alignUp(as->bufferRegion.offset, AS_OFFSET_ALIGNMENT),
+        .size   = size,
+        .type   = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR};
+
+    V_ASSERT(vkCreateAccelerationStructureKHR(device, &info, NULL, &as->handle));
+}
+
+// builds or refits, then waits
+static void
+submitBuilds(const Obdn_Instance* instance, const uint32_t count,
+             BuildInput* inputs, const VkQueryPool queryPool,
+             const AccelerationStructure* blasses)
+{
+    Obdn_V_Command cmd =
+        obdn_CreateCommand(instance, OBDN_V_QUEUE_GRAPHICS_TYPE);
+    obdn_BeginCommandBuffer(cmd.buffer);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const VkAccelerationStructureBuildRangeInfoKHR* range =
+            &inputs[i].range;
+        vkCmdBuildAccelerationStructuresKHR(cmd.buffer, 1, &inputs[i].info,
+                                            &range);
+    }
+
+    if (queryPool)
+    {
+        const VkMemoryBarrier barrier = {
+            .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+            .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR};
+
+        vkCmdPipelineBarrier(cmd.buffer,
+                             VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                             VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                             0, 1, &barrier, 0, NULL, 0, NULL);
+
+        VkAccelerationStructureKHR handles[count];
+        for (uint32_t i = 0; i < count; i++)
+            handles[i] = blasses[i].handle;
+
+        vkCmdResetQueryPool(cmd.buffer, queryPool, 0, count);
+        vkCmdWriteAccelerationStructuresPropertiesKHR(
+            cmd.buffer, count, handles,
+            VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool,
+            0);
+    }
+
+    obdn_EndCommandBuffer(cmd.buffer);
+    obdn_SubmitAndWait(&cmd, 0);
+    obdn_DestroyCommand(cmd);
+
+    for (uint32_t i = 0; i < count; i++)
+        obdn_FreeBufferRegion(&inputs[i].scratch);
+}
+
+// copies each blas into one of its compacted size and destroys the original
+static void
+compactBlasses(const Obdn_Instance* instance, Obdn_Memory* memory,
+               const uint32_t count, const VkQueryPool queryPool,
+               AccelerationStructure* blasses)
+{
+    const VkDevice device = obdn_GetDevice(instance);
+
+    VkDeviceSize compactSizes[count];
+    V_ASSERT(vkGetQueryPoolResults(
+        device, queryPool, 0, count, sizeof(compactSizes), compactSizes,
+        sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+    AccelerationStructure compacted[count];
+
+    Obdn_V_Command cmd =
+        obdn_CreateCommand(instance, OBDN_V_QUEUE_GRAPHICS_TYPE);
+    obdn_BeginCommandBuffer(cmd.buffer);
+
+    VkDeviceSize before = 0, after = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        createStructure(device, memory, compactSizes[i], &compacted[i]);
+
+        const VkCopyAccelerationStructureInfoKHR copy = {
+            .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+            .src   = blasses[i].handle,
+            .dst   = compacted[i].handle,
+            .mode  = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR};
+        vkCmdCopyAccelerationStructureKHR(cmd.buffer, &copy);
+
+        before += blasses[i].bufferRegion.size;
+        after += compacted[i].bufferRegion.size;
+    }
+
+    obdn_EndCommandBuffer(cmd.buffer);
+    obdn_SubmitAndWait(&cmd, 0);
+    obdn_DestroyCommand(cmd);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        obdn_DestroyAccelerationStruct(device, &blasses[i]);
+        blasses[i] = compacted[i];
+    }
+
+    hell_DebugPrint(PAINT_DEBUG_TAG_PAINT, "blasses compacted from %ld to %ld bytes\n",
+                    (long)before, (long)after);
+}
+
+void
+dali_BuildBlasses(const Obdn_Instance* instance, Obdn_Memory* memory,
+                  const uint32_t count, const Obdn_Geometry* const* geos,
+                  AccelerationStructure* blasses)
+{
+    const VkDevice device    = obdn_GetDevice(instance);
+    const uint32_t alignment = scratchAlignment(instance);
+
+    BuildInput* inputs = hell_Malloc(count * sizeof(BuildInput));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        memset(&blasses[i], 0, sizeof(AccelerationStructure));
+        fillBuildInput(device, geos[i],
+                       VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+                       &inputs[i]);
+        createStructure(device, memory,
+                        inputs[i].sizes.accelerationStructureSize,
+                        &blasses[i]);
+        allocScratch(device, memory, inputs[i].sizes.buildScratchSize,
+                     alignment, &inputs[i]);
+        inputs[i].info.dstAccelerationStructure = blasses[i].handle;
+    }
+
+    const VkQueryPoolCreateInfo poolInfo = {
+        .sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType  = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+        .queryCount = count};
+    VkQueryPool queryPool;
+    V_ASSERT(vkCreateQueryPool(device, &poolInfo, NULL, &queryPool));
+
+    submitBuilds(instance, count, inputs, queryPool, blasses);
+    compactBlasses(instance, memory, count, queryPool, blasses);
+
+    vkDestroyQueryPool(device, queryPool, NULL);
+    hell_Free(inputs);
+}
+
+void
+dali_RefitBlasses(const Obdn_Instance* instance, Obdn_Memory* memory,
+                  const uint32_t count, const Obdn_Geometry* const* geos,
+                  AccelerationStructure* blasses)
+{
+    const VkDevice device    = obdn_GetDevice(instance);
+    const uint32_t alignment = scratchAlignment(instance);
+
+    BuildInput* inputs = hell_Malloc(count * sizeof(BuildInput));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        fillBuildInput(device, geos[i],
+                       VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR,
+                       &inputs[i]);
+        allocScratch(device, memory, inputs[i].sizes.updateScratchSize,
+                     alignment, &inputs[i]);
+        inputs[i].info.srcAccelerationStructure = blasses[i].handle;
+        inputs[i].info.dstAccelerationStructure = blasses[i].handle;
+    }
+
+    submitBuilds(instance, count, inputs, VK_NULL_HANDLE, blasses);
+    hell_Free(inputs);
+}
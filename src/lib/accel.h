@@ -0,0 +1,22 @@
+#ifndef DALI_ACCEL_H
+#define DALI_ACCEL_H
+
+#include <obsidian/geo.h>
+#include <obsidian/raytrace.h>
+
+// bottom level structures the engine can refit when a primitive deforms. they
+// are built to allow updates and compacted right after their first build, and
+// are destroyed with obdn_DestroyAccelerationStruct like obsidian's own.
+
+// builds a blas per geometry from scratch. blocks until they are compacted.
+void dali_BuildBlasses(const Obdn_Instance* instance, Obdn_Memory* memory,
+                       const uint32_t count, const Obdn_Geometry* const* geos,
+                       Obdn_R_AccelerationStructure* blasses);
+
+// refits each blas in place to new vertex positions. each geometry must have
+// the same topology the blas was built from. blocks until done.
+void dali_RefitBlasses(const Obdn_Instance* instance, Obdn_Memory* memory,
+                       const uint32_t count, const Obdn_Geometry* const* geos,
+                       Obdn_R_AccelerationStructure* blasses);
+
+#endif /* end of include guard: DALI_ACCEL_H */
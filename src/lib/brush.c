@@ -29,6 +29,13 @@ static void setBrushRadiusCmd(const Hell_Grimoire* grim, void* brushptr)
     dali_SetBrushRadius(brush, r);
 }
 
+static void setBrushQualityCmd(const Hell_Grimoire* grim, void* brushptr)
+{
+    Dali_Brush* brush = brushptr;
+    float q = atof(hell_GetArg(grim, 1));
+    dali_SetBrushQuality(brush, q);
+}
+
 static void setBrushActiveCmd(const Hell_Grimoire* grim, void* brushptr)
 {
     Dali_Brush* brush = brushptr;
@@ -41,6 +48,18 @@ static void setBrushInactiveCmd(const Hell_Grimoire* grim, void* brushptr)
     dali_SetBrushInactive(brush);
 }
 
+static void setBrushPaintCmd(const Hell_Grimoire* grim, void* brushptr)
+{
+    Dali_Brush* brush = brushptr;
+    dali_SetBrushPaint(brush);
+}
+
+static void setBrushEraseCmd(const Hell_Grimoire* grim, void* brushptr)
+{
+    Dali_Brush* brush = brushptr;
+    dali_SetBrushErase(brush);
+}
+
 Dali_Brush* dali_AllocBrush(void)
 {
     return hell_Malloc(sizeof(Dali_Brush));
@@ -55,6 +74,7 @@ void dali_CreateBrush(Hell_Grimoire* grim, Dali_Brush *brush)
     brush->b = .5;
     brush->radius = 1.0;
     brush->falloff = 0.8;
+    brush->quality = 1.0;
     brush->mode = PAINT_MODE_OVER;
     brush->dirt |= BRUSH_BIT;
 
@@ -63,8 +83,11 @@ void dali_CreateBrush(Hell_Grimoire* grim, Dali_Brush *brush)
         hell_AddCommand(grim, "brushpos", setBrushPosCmd, brush);
         hell_AddCommand(grim, "brushcol", setBrushColorCmd, brush);
         hell_AddCommand(grim, "brushrad", setBrushRadiusCmd, brush);
+        hell_AddCommand(grim, "brushq", setBrushQualityCmd, brush);
         hell_AddCommand(grim, "brusha", setBrushActiveCmd, brush);
         hell_AddCommand(grim, "brushia", setBrushInactiveCmd, brush);
+        hell_AddCommand(grim, "brushpaint", setBrushPaintCmd, brush);
+        hell_AddCommand(grim, "brusherase", setBrushEraseCmd, brush);
     }
 }
 
@@ -89,6 +112,17 @@ void dali_SetBrushRadius(Dali_Brush* brush, float r)
     brush->dirt |= BRUSH_BIT;
 }
 
+float dali_GetBrushRadius(const Dali_Brush* brush)
+{
+    return brush->radius;
+}
+
+void dali_SetBrushQuality(Dali_Brush* brush, float q)
+{
+    brush->quality = q;
+    brush->dirt |= BRUSH_BIT;
+}
+
 void dali_SetBrushActive(Dali_Brush* brush)
 {
     brush->active = true;
@@ -100,3 +134,21 @@ void dali_SetBrushInactive(Dali_Brush* brush)
     brush->active = false;
     brush->dirt |= BRUSH_BIT;
 }
+
+// the brush color depends on the mode too
+void dali_SetBrushPaint(Dali_Brush* brush)
+{
+    brush->mode = PAINT_MODE_OVER;
+    brush->dirt |= BRUSH_BIT | PAINT_MODE_BIT;
+}
+
+void dali_SetBrushErase(Dali_Brush* brush)
+{
+    brush->mode = PAINT_MODE_ERASE;
+    brush->dirt |= BRUSH_BIT | PAINT_MODE_BIT;
+}
+
+void dali_BrushClearDirt(Dali_Brush* brush)
+{
+    brush->dirt = 0;
+}
@@ -11,7 +11,15 @@ void dali_CreateBrush(Hell_Grimoire* grim /* optional */, Dali_Brush *brush);
 void dali_SetBrushActive(Dali_Brush* brush);
 void dali_SetBrushInactive(Dali_Brush* brush);
 void dali_SetBrushRadius(Dali_Brush* brush, float r);
+float dali_GetBrushRadius(const Dali_Brush* brush);
+// rays traced per texel along each axis of a dab's footprint. 1 by default;
+// lower is faster but may leave gaps.
+void dali_SetBrushQuality(Dali_Brush* brush, float q);
 void dali_SetBrushPos(Dali_Brush* brush, float x, float y);
 void dali_SetBrushColor(Dali_Brush* brush, float r, float g, float b);
+// paint lays the brush color over the layer, erase removes coverage from it
+void dali_SetBrushPaint(Dali_Brush* brush);
+void dali_SetBrushErase(Dali_Brush* brush);
+void dali_BrushClearDirt(Dali_Brush* brush);
 
 #endif /* end of include guard: DALI_BRUSH_H */
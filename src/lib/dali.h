@@ -5,6 +5,7 @@
 #include "layer.h"
 #include "engine.h"
 #include "undo.h"
+#include "record.h"
 
 #define DALI_TEXSIZE(res, bytes_per_channel, channel_count) (res * res * bytes_per_channel * channel_count)
 
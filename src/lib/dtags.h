@@ -2,3 +2,4 @@
 #define PAINT_DEBUG_TAG_LAYER "PAINT_LAYER"
 #define PAINT_DEBUG_TAG_UNDO  "PAINT_UNDO"
 #define PAINT_DEBUG_TAG_PAINT "PAINT_PAINT"
+#define PAINT_DEBUG_TAG_PIPE  "PAINT_PIPE"
@@ -1,7 +1,11 @@
 #include "engine.h"
+#include "accel.h"
 #include "dtags.h"
 #include "layer.h"
+#include "layerpool.h"
+#include "pipeline.h"
 #include "private.h"
+#include "profiler.h"
 #include "ubo-shared.h"
 #include "undo.h"
 #include <hell/common.h>
@@ -16,62 +20,267 @@
 #include <obsidian/pipeline.h>
 #include <obsidian/raytrace.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define SPVDIR "dali"
 
-enum { DESC_SET_PRIM, DESC_SET_PAINT, DESC_SET_COMP, DESC_SET_COUNT };
+#define MAX_DABS 30 // dabs traced per frame
 
+// the stamp only holds coverage. the brush color is applied when it is
+// blended onto the layer. it is stored as float bits in an integer format so
+// the raygen can keep the max with an image atomic.
+#define STAMP_FORMAT VK_FORMAT_R32_UINT
+
+// bounds on the rays launched along each axis of a dab
+#define MIN_DAB_LAUNCH 16
+#define MAX_DAB_LAUNCH 2000
+
+// refits degrade a blas, so it is rebuilt after this many in a row
+#define MAX_BLAS_REFITS 32
+
+// until dali_SeedEngine says otherwise
+#define DEFAULT_SEED 0x9e3779b97f4a7c15
+
+// tiles the backup staging buffer starts with. it doubles whenever a backup
+// captures more, up to a whole layer.
+#define MIN_STAGING_TILES 16
+
+enum {
+    DESC_SET_PRIM,
+    DESC_SET_PAINT,
+    DESC_SET_COMP,
+    DESC_SET_LAYERS, // what the composite reads and writes
+    DESC_SET_COUNT
+};
+
+// flattened runs of layers kept for the composite to reuse. a frame reads at
+// most two, the layers below the active one and those above it, so this
+// leaves room for switching between two layers without rebuilding either.
+// they are created when first needed, and only as many as the memory the
+// resident layers leave of their budget holds, see flatLimit.
+#define FLAT_IMAGE_COUNT 4
+
+// the composite's image array holds the active layer, imageB, followed by the
+// flat images and the slots of the layer pool. the slots take what is left
+// of the sampled images the device can bind, see slotCapacity.
+#define COMP_IMAGE_ACTIVE 0
+#define COMP_IMAGE_FLAT   1
+#define COMP_IMAGE_SLOTS  (COMP_IMAGE_FLAT + FLAT_IMAGE_COUNT)
+
+// each slot is a whole layer, so memory runs out long before a device that
+// binds more images than this would run out of descriptors
+#define MAX_LAYER_SLOTS 1024
+
+// and its storage images imageA, followed by the flat images
+#define COMP_TARGET_COMPOSITE 0
+#define COMP_TARGET_FLAT      1
+#define COMP_TARGET_COUNT     (COMP_TARGET_FLAT + FLAT_IMAGE_COUNT)
+
+// the layer table lists the visible layers, followed by what the frame's
+// composite blends: at most every layer and a flat image on either side
+#define COMP_TABLE_SIZE(layerCount) (2 * (layerCount) + 2)
+
+// marks a table entry whose image is not a layer, see compLayers
+#define COMP_LAYER_FIXED UINT16_MAX
+
+// the occupancy the composite reads has a row per flat image, followed by one
+// per layer, by id. a row packs a Dali_TileOccupancy per tile into 2 bits.
+#define OCC_ROW_FLAT              0
+#define OCC_ROW_LAYERS            FLAT_IMAGE_COUNT
+#define OCC_ROW_COUNT(layerCount) (OCC_ROW_LAYERS + (layerCount))
+#define OCC_BITS                  2
+#define OCC_PER_WORD              (32 / OCC_BITS)
+
+// the fewest layers the budget keeps room for, however little memory the
+// device has: the active one's copy and one more, so switching between two
+// layers stays on the device
+#define MIN_RESIDENT_LAYERS 2
+
+// the share of the largest device local heap the resident layers and the
+// flat images may take, however many layers the app asks to keep resident
+#define RESIDENT_HEAP_SHARE 4
+
+// layers the composite's tables start out with room for. they double
+// whenever the stack outgrows them.
+#define MIN_COMP_LAYERS 8
+
+// the composite's workgroups are this many texels along each side, see
+// composite.comp
+#define COMP_GROUP_SIZE 16
+
+// the composite's CompBatch follows the ray gen's jitter in the push constants
+#define COMP_BATCH_OFFSET (sizeof(float) * 2)
+
+// a profiler slot per frame in flight, numbered the same, and one for the
+// sync commands
+#define PROFILER_SLOT_SYNC  DALI_FRAMES_IN_FLIGHT
+#define PROFILER_SLOT_COUNT (DALI_FRAMES_IN_FLIGHT + 1)
+
+// the stamp is applied with one pipeline per paint mode, all built up front
+// so that switching modes only changes which one is bound
 enum {
-    PIPELINE_COMP_1,
-    PIPELINE_COMP_2,
-    PIPELINE_COMP_3,
-    PIPELINE_COMP_4,
-    PIPELINE_COMP_SINGLE,
+    PIPELINE_APPLY_OVER,
+    PIPELINE_APPLY_ERASE,
+    PIPELINE_CLEAR_STAMP,
     PIPELINE_COMP_COUNT
 };
 
+// the layers the composite blends, in the layout composite.comp reads
+typedef struct CompLayerTable {
+    uint32_t  count;
+    uint32_t  pad[3];
+    CompLayer layers[]; // COMP_TABLE_SIZE of the layer capacity
+} CompLayerTable;
+
 typedef Obdn_V_BufferRegion BufferRegion;
 
+typedef struct PrimTopology {
+    uint32_t vertexCount;
+    uint32_t indexCount;
+} PrimTopology;
+
+// where paint.rchit finds an instance's geometry, see Prim in paint.rchit
+typedef struct PrimAddresses {
+    VkDeviceAddress uvs;
+    VkDeviceAddress indices;
+} PrimAddresses;
+
 typedef Obdn_V_Command Command;
 typedef Obdn_V_Image   Image;
 
-typedef struct Dali_Engine {
-    BufferRegion matrixRegion;
-    BufferRegion brushRegion;
+// a layer as it was when a flat image was built from it. compared with
+// memcmp, so it has no padding.
+typedef struct FlatLayer {
+    uint32_t id;
+    uint32_t version;
+    float    opacity;
+    uint32_t blendMode;
+} FlatLayer;
+
+// a run of layers blended into one image, premultiplied. it is reused for as
+// long as the same layers, unchanged, make up the run.
+typedef struct FlatImage {
+    Image     image;
+    uint32_t  use; // when last used, 0 if it holds nothing
+    uint32_t  layerCount;
+    FlatLayer* layers; // layerCount of them
+    uint8_t*  occupancy; // a Dali_TileOccupancy per tile
+} FlatImage;
+
+// what the paint commands of one frame in flight read and write. the host
+// only touches a frame again once the commands recorded for it have completed.
+typedef struct Frame {
+    BufferRegion    matrixRegion;
+    BufferRegion    brushRegion;
+    BufferRegion    dirtyTileRegion; // one uint per tile, set by paint.rgen
+    BufferRegion    dabRegion;       // the frame's dab positions
+    BufferRegion    dabBoundsRegion; // texel bounds of each dab, 0 is the union
+    BufferRegion    layerTableRegion; // a CompLayerTable
+    BufferRegion    occupancyRegion;  // OCC_ROW_COUNT rows of occupancy
+    uint16_t        layerCapacity;    // layers the two above have room for
+    uint32_t        dabCount;
+    float           dabRadius;       // the brush radius the dabs were traced at
+    uint64_t        doneValue;       // signaled once the frame has completed
+    VkDescriptorSet descriptorSet;   // the frame's DESC_SET_PAINT
+} Frame;
 
+typedef struct Dali_Engine {
+    Frame        frames[DALI_FRAMES_IN_FLIGHT];
+    uint32_t     frameIndex;
+    // copied into the frame's uniform buffers as each frame is recorded
+    UboMatrices  uboMatrices;
+    UboBrush     uboBrush;
+    CompLayerTable* layerTable;
+    uint32_t       occupancyRowSize; // in words
+    Dali_LayerId*  compLayers; // of each entry in the table
+    uint16_t       layerCapacity; // layers the tables and layerSlots have room for
+    uint32_t       compBelow; // visible layers below the active one
+    uint32_t       compAbove; // the first visible layer above it
+
+    VkPipelineCache           pipelineCache; // persists across runs
     VkPipeline                paintPipeline;
     Obdn_R_ShaderBindingTable shaderBindingTable;
 
     VkPipeline compPipelines[PIPELINE_COMP_COUNT];
+    VkPipeline compositePipeline;
+    PaintMode  paintMode; // selects the apply pipeline
 
     VkDescriptorSetLayout descriptorSetLayouts[DESC_SET_COUNT];
-    Obdn_R_Description    description;
+    Obdn_R_Description    description; // its DESC_SET_PAINT goes unused
+    Obdn_R_Description    frameDescription;
 
     uint32_t graphicsQueueFamilyIndex;
     uint32_t transferQueueFamilyIndex;
 
     uint32_t textureSize; // = 0x1000; // 0x1000 = 4096
-
-    Command releaseImageCommand;
-    Command transferImageCommand;
-    Command acquireImageCommand;
-
-    Command paintCommand;
-
-    Image imageA; // will use for brush and then as final frambuffer target
-    Image imageB;
-    Image imageC; // primarily background layers
-    Image imageD; // primarily foreground layers
+    uint32_t tilesPerSide;
+    uint32_t tileCount;
+
+    // tiles of imageB written since the active layer was last stored
+    bool*    dirtyTiles;
+    // tiles the gpu has written back to the stack since the last trim
+    bool*    storedTiles;
+
+    // tiles being copied between imageB and the stack
+    uint32_t             transferCount;
+    uint32_t*            transferTiles;
+    const BufferRegion** transferRegions;
+
+    // backups and undos recorded during sync() go out in one graphics
+    // submission. backups are captured into stagingRegion there, and drained
+    // to the stack's host tiles on the transfer queue afterwards. it holds as
+    // many tiles as the largest backup so far.
+    Command      syncCommand;
+    Command      drainCommand;
+    BufferRegion stagingRegion;
+    bool         syncRecording;
+    bool         syncCaptured;
+    VkQueue      transferQueue;
+    // one timeline per queue the engine submits to. every submission signals
+    // the next value on its own queue's timeline and waits on the values it
+    // depends on. the app's paint submissions signal the graphics timeline too.
+    VkSemaphore  graphicsTimeline;
+    VkSemaphore  transferTimeline;
+    uint64_t     graphicsValue; // the last value handed out
+    uint64_t     syncValue;     // signaled by the last sync submission
+    uint64_t     transferValue; // signaled by the last drain
+    // a layer change stores tiles back to the stack. the empty ones are
+    // trimmed once the graphics timeline reaches trimValue.
+    bool         trimPending;
+    Dali_LayerId trimLayer;
+    uint64_t     trimValue;
+
+
+    Dali_Profiler profiler;
+
+    Image stampImage; // what the frame's dabs wrote, cleared once applied
+    Image imageA; // the composite of the whole stack
+    Image imageB; // the active layer
+
+    FlatImage flatImages[FLAT_IMAGE_COUNT];
+    uint8_t   flatCount; // created, from the first on
+    uint32_t  flatClock;
+
+    // the device copies of the most recently used layers, read by the
+    // composite. a layer without a slot is uploaded from the stack's host
+    // tiles when it is next needed, evicting the least recently used one. the
+    // active layer's copy goes unused until another layer is made active and
+    // it is refreshed from imageB.
+    Dali_LayerPool layerPool;
+    uint32_t       layerBudget;   // layer sized images the heap can spare
+    uint16_t       slotCapacity;  // slots the composite can bind
+    uint16_t       residentLimit; // slots the pool may grow to
+    int16_t*       layerSlots;    // by layer id, -1 if not resident
+    Dali_LayerId*  slotLayers;
+    uint32_t*      slotUse; // when last used, 0 if free
+    uint32_t       useClock;
+    uint64_t       uploadCount; // layers uploaded from the stack
 
     VkFramebuffer applyPaintFrameBuffer;
-    VkFramebuffer compositeFrameBuffer;
-    VkFramebuffer backgroundFrameBuffer;
-    VkFramebuffer foregroundFrameBuffer;
 
-    VkRenderPass singleCompositeRenderPass;
     VkRenderPass applyPaintRenderPass;
-    VkRenderPass compositeRenderPass;
 
     VkFormat textureFormat; // = VK_FORMAT_R8G8B8A8_UNORM;
 
@@ -80,8 +289,13 @@ typedef struct Dali_Engine {
 
     VkPipelineLayout pipelineLayout;
 
-    Obdn_R_AccelerationStructure bottomLevelAS;
-    Obdn_R_AccelerationStructure topLevelAS;
+    // one blas and one tlas instance per scene primitive, in scene order
+    uint32_t                      blasCount;
+    Obdn_R_AccelerationStructure* blasses;
+    PrimTopology*                 blasTopologies; // what each was built from
+    uint32_t                      blasRefits;     // since the last full build
+    Obdn_R_AccelerationStructure  topLevelAS;
+    BufferRegion                  primTableRegion; // a PrimAddresses per instance
 
     Dali_LayerId curLayerId;
 
@@ -89,8 +303,16 @@ typedef struct Dali_Engine {
     Obdn_PrimitiveHandle activePrim;
 
     bool                 brushActive;
+    bool                 compositeDirty; // imageA no longer shows the stack
     Vec2                 prevBrushPos;
     Vec2                 brushPos;
+    float                brushRadius;
+    float                brushQuality;
+    // texels a dab spans per unit of brush radius, as last measured
+    float                texelsPerRadius;
+    // jitters the rays of each dab. owned by the engine so that a replay
+    // seeded the same way traces the same rays.
+    uint64_t             rngState;
     Obdn_Memory*         memory;
     const Obdn_Instance* instance;
     VkDevice             device;
@@ -103,6 +325,14 @@ typedef Dali_Engine Engine;
 static void
 initPaintImages(Dali_Engine* engine)
 {
+    engine->stampImage = obdn_CreateImageAndSampler(
+        engine->memory, engine->textureSize, engine->textureSize,
+        STAMP_FORMAT,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+            VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+        VK_IMAGE_ASPECT_COLOR_BIT, VK_SAMPLE_COUNT_1_BIT, 1, VK_FILTER_NEAREST,
+        OBDN_V_MEMORY_DEVICE_TYPE);
+
     engine->imageA = obdn_CreateImageAndSampler(
         engine->memory, engine->textureSize, engine->textureSize,
         engine->textureFormat,
@@ -117,71 +347,49 @@ initPaintImages(Dali_Engine* engine)
         engine->memory, engine->textureSize, engine->textureSize,
         engine->textureFormat,
         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
-            VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT |
+            VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
             VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
         VK_IMAGE_ASPECT_COLOR_BIT, VK_SAMPLE_COUNT_1_BIT, 1, VK_FILTER_LINEAR,
         OBDN_V_MEMORY_DEVICE_TYPE);
 
-    engine->imageC = obdn_CreateImageAndSampler(
-        engine->memory, engine->textureSize, engine->textureSize,
-        engine->textureFormat,
-        VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
-            VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-        VK_IMAGE_ASPECT_COLOR_BIT, VK_SAMPLE_COUNT_1_BIT, 1, VK_FILTER_LINEAR,
-        OBDN_V_MEMORY_DEVICE_TYPE);
-
-    engine->imageD = obdn_CreateImageAndSampler(
-        engine->memory, engine->textureSize, engine->textureSize,
-        engine->textureFormat,
-        VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
-            VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-        VK_IMAGE_ASPECT_COLOR_BIT, VK_SAMPLE_COUNT_1_BIT, 1, VK_FILTER_LINEAR,
-        OBDN_V_MEMORY_DEVICE_TYPE);
-
-    obdn_TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED,
-                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                               &engine->imageA);
     obdn_TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED,
                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                               &engine->imageB);
+                               &engine->stampImage);
     obdn_TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED,
                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                               &engine->imageC);
+                               &engine->imageA);
     obdn_TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED,
                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                               &engine->imageD);
+                               &engine->imageB);
 
+    obdn_v_ClearColorImage(&engine->stampImage);
     obdn_v_ClearColorImage(&engine->imageA);
     obdn_v_ClearColorImage(&engine->imageB);
-    obdn_v_ClearColorImage(&engine->imageC);
-    obdn_v_ClearColorImage(&engine->imageD);
 
+    // the stamp stays in general layout. it is written by the paint raygen and
+    // read and cleared as an attachment.
+    obdn_TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED,
+                               VK_IMAGE_LAYOUT_GENERAL,
+                               &engine->stampImage);
     obdn_TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED,
                                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
                                &engine->imageA);
     obdn_TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED,
                                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
                                &engine->imageB);
-    obdn_TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED,
-                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                               &engine->imageC);
-    obdn_TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED,
-                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                               &engine->imageD);
 }
 
 static void
 initRenderPasses(Engine* engine)
 {
-    // apply paint renderpass
+    // apply paint renderpass. the first subpass blends the stamp onto the
+    // layer, the second clears the stamp over the same bounds.
     {
-        const VkAttachmentDescription attachmentA = {
-            .format        = engine->textureFormat,
+        const VkAttachmentDescription attachmentStamp = {
+            .format        = STAMP_FORMAT,
             .samples       = VK_SAMPLE_COUNT_1_BIT,
             .loadOp        = VK_ATTACHMENT_LOAD_OP_LOAD,
-            .storeOp       = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .storeOp       = VK_ATTACHMENT_STORE_OP_STORE,
             .initialLayout = VK_IMAGE_LAYOUT_GENERAL,
             .finalLayout   = VK_IMAGE_LAYOUT_GENERAL,
         };
@@ -195,195 +403,85 @@ initRenderPasses(Engine* engine)
             .finalLayout   = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
         };
 
-        const VkAttachmentReference referenceA1 = {
+        const VkAttachmentReference referenceStamp = {
             .attachment = 0,
-            .layout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+            .layout     = VK_IMAGE_LAYOUT_GENERAL};
 
         const VkAttachmentReference referenceB1 = {
             .attachment = 1,
             .layout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
 
-        VkSubpassDescription subpass1 = {
+        const VkSubpassDescription subpass1 = {
             .pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS,
             .colorAttachmentCount    = 1,
             .pColorAttachments       = &referenceB1,
             .pDepthStencilAttachment = NULL,
             .inputAttachmentCount    = 1,
-            .pInputAttachments       = &referenceA1,
-            .preserveAttachmentCount = 0,
-        };
-
-        const VkSubpassDependency dependency1 = {
-            .srcSubpass    = VK_SUBPASS_EXTERNAL,
-            .dstSubpass    = 0,
-            .srcStageMask  = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
-            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
-            .dstStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-        };
-
-        const VkSubpassDependency dependency2 = {
-            .srcSubpass    = 0,
-            .dstSubpass    = VK_SUBPASS_EXTERNAL,
-            .srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-            .dstStageMask  = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-        };
-
-        VkSubpassDependency dependencies[] = {dependency1, dependency2};
-
-        VkAttachmentDescription attachments[] = {attachmentA, attachmentB};
-
-        VkRenderPassCreateInfo ci = {
-            .sType           = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-            .subpassCount    = 1,
-            .pSubpasses      = &subpass1,
-            .attachmentCount = LEN(attachments),
-            .pAttachments    = attachments,
-            .dependencyCount = LEN(dependencies),
-            .pDependencies   = dependencies,
-        };
-
-        V_ASSERT(vkCreateRenderPass(engine->device, &ci, NULL,
-                                    &engine->applyPaintRenderPass));
-    }
-
-    // comp renderpass
-    {
-        const VkAttachmentDescription attachmentB = {
-            .format        = engine->textureFormat,
-            .samples       = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp        = VK_ATTACHMENT_LOAD_OP_LOAD,
-            .storeOp       = VK_ATTACHMENT_STORE_OP_STORE,
-            .initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-            .finalLayout   = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        };
-
-        const VkAttachmentDescription attachmentC = {
-            .format        = engine->textureFormat,
-            .samples       = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp        = VK_ATTACHMENT_LOAD_OP_LOAD,
-            .storeOp       = VK_ATTACHMENT_STORE_OP_STORE,
-            .initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-            .finalLayout   = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        };
-
-        const VkAttachmentDescription attachmentD = {
-            .format        = engine->textureFormat,
-            .samples       = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp        = VK_ATTACHMENT_LOAD_OP_LOAD,
-            .storeOp       = VK_ATTACHMENT_STORE_OP_STORE,
-            .initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-            .finalLayout   = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        };
-
-        const VkAttachmentDescription attachmentA2 = {
-            .format        = engine->textureFormat,
-            .samples       = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp        = VK_ATTACHMENT_LOAD_OP_CLEAR,
-            .storeOp       = VK_ATTACHMENT_STORE_OP_STORE,
-            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout   = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        };
-
-        const VkAttachmentReference referenceB2 = {
-            .attachment = 0,
-            .layout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
-
-        const VkAttachmentReference referenceC2 = {
-            .attachment = 1,
-            .layout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
-
-        const VkAttachmentReference referenceD2 = {
-            .attachment = 2,
-            .layout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
-
-        const VkAttachmentReference referenceA2 = {
-            .attachment = 3,
-            .layout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
-
-        VkSubpassDescription subpass1 = {
-            .pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS,
-            .colorAttachmentCount    = 1,
-            .pColorAttachments       = &referenceA2,
-            .pDepthStencilAttachment = NULL,
-            .inputAttachmentCount    = 1,
-            .pInputAttachments       = &referenceC2,
-            .preserveAttachmentCount = 0,
-        };
-
-        VkSubpassDescription subpass2 = {
-            .pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS,
-            .colorAttachmentCount    = 1,
-            .pColorAttachments       = &referenceA2,
-            .pDepthStencilAttachment = NULL,
-            .inputAttachmentCount    = 1,
-            .pInputAttachments       = &referenceB2,
+            .pInputAttachments       = &referenceStamp,
             .preserveAttachmentCount = 0,
         };
 
-        VkSubpassDescription subpass3 = {
+        const VkSubpassDescription subpass2 = {
             .pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS,
             .colorAttachmentCount    = 1,
-            .pColorAttachments       = &referenceA2,
+            .pColorAttachments       = &referenceStamp,
             .pDepthStencilAttachment = NULL,
-            .inputAttachmentCount    = 1,
-            .pInputAttachments       = &referenceD2,
+            .inputAttachmentCount    = 0,
             .preserveAttachmentCount = 0,
         };
 
+        // the vertex shader reads the bounds the raygen wrote
         const VkSubpassDependency dependency1 = {
             .srcSubpass    = VK_SUBPASS_EXTERNAL,
             .dstSubpass    = 0,
-            .srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-            .dstStageMask  = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-            .dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+            .srcStageMask  = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstStageMask  = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                             VK_ACCESS_INPUT_ATTACHMENT_READ_BIT |
+                             VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
         };
 
+        // the composite reads the layer
         const VkSubpassDependency dependency2 = {
             .srcSubpass    = 0,
-            .dstSubpass    = 1,
+            .dstSubpass    = VK_SUBPASS_EXTERNAL,
             .srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
             .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-            .dstStageMask  = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-            .dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+            .dstStageMask  = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
         };
 
         const VkSubpassDependency dependency3 = {
-            .srcSubpass    = 1,
-            .dstSubpass    = 2,
-            .srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-            .dstStageMask  = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-            .dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+            .srcSubpass      = 0,
+            .dstSubpass      = 1,
+            .srcStageMask    = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            .srcAccessMask   = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+            .dstStageMask    = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .dstAccessMask   = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
         };
 
+        // the next frame's raygen reads and writes the cleared stamp
         const VkSubpassDependency dependency4 = {
-            .srcSubpass    = 2,
+            .srcSubpass    = 1,
             .dstSubpass    = VK_SUBPASS_EXTERNAL,
             .srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
             .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-            .dstStageMask  = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .dstStageMask  = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                             VK_ACCESS_SHADER_WRITE_BIT,
         };
 
-        VkSubpassDescription subpasses[] = {
-            subpass1,
-            subpass2,
-            subpass3,
-        };
+        VkSubpassDescription subpasses[] = {subpass1, subpass2};
 
-        VkSubpassDependency dependencies[] = {
-            dependency1,
-            dependency2,
-            dependency3,
-            dependency4,
-        };
+        VkSubpassDependency dependencies[] = {dependency1, dependency2,
+                                              dependency3, dependency4};
 
-        VkAttachmentDescription attachments[] = {attachmentB, attachmentC,
-                                                 attachmentD, attachmentA2};
+        VkAttachmentDescription attachments[] = {attachmentStamp, attachmentB};
 
         VkRenderPassCreateInfo ci = {
             .sType           = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
@@ -396,109 +494,96 @@ initRenderPasses(Engine* engine)
         };
 
         V_ASSERT(vkCreateRenderPass(engine->device, &ci, NULL,
-                                    &engine->compositeRenderPass));
+                                    &engine->applyPaintRenderPass));
     }
+}
 
-    {
-        const VkAttachmentDescription srcAttachment = {
-            .format        = engine->textureFormat,
-            .samples       = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp        = VK_ATTACHMENT_LOAD_OP_LOAD,
-            .storeOp       = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            .finalLayout   = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        };
+// sizes the frame's layer table and occupancy to the engine's layer capacity
+static void
+requestFrameLayerRegions(Engine* engine, Frame* frame)
+{
+    const uint16_t capacity = engine->layerCapacity;
 
-        const VkAttachmentDescription dstAttachment = {
-            .format        = engine->textureFormat,
-            .samples       = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp        = VK_ATTACHMENT_LOAD_OP_LOAD,
-            .storeOp       = VK_ATTACHMENT_STORE_OP_STORE,
-            .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-            .finalLayout   = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        };
+    frame->layerTableRegion = obdn_RequestBufferRegion(
+        engine->memory,
+        sizeof(CompLayerTable) + sizeof(CompLayer) * COMP_TABLE_SIZE(capacity),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
 
-        const VkAttachmentReference refSrc = {
-            .attachment = 0,
-            .layout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    frame->occupancyRegion = obdn_RequestBufferRegion(
+        engine->memory,
+        sizeof(uint32_t) * OCC_ROW_COUNT(capacity) * engine->occupancyRowSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
 
-        const VkAttachmentReference refDst = {
-            .attachment = 1,
-            .layout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    frame->layerCapacity = capacity;
+}
 
-        const VkSubpassDescription subpass = {
-            .pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS,
-            .colorAttachmentCount    = 1,
-            .pColorAttachments       = &refDst,
-            .pDepthStencilAttachment = NULL,
-            .inputAttachmentCount    = 1,
-            .pInputAttachments       = &refSrc,
-            .preserveAttachmentCount = 0,
-        };
+static void
+initUniformBuffers(Engine* engine)
+{
+    engine->uboMatrices.model   = coal_Ident_Mat4();
+    engine->uboMatrices.view    = coal_Ident_Mat4();
+    engine->uboMatrices.proj    = coal_Ident_Mat4();
+    engine->uboMatrices.viewInv = coal_Ident_Mat4();
+    engine->uboMatrices.projInv = coal_Ident_Mat4();
 
-        const VkSubpassDependency dependencies[] = {
-            {
-                .srcSubpass    = VK_SUBPASS_EXTERNAL,
-                .dstSubpass    = 0,
-                .srcStageMask  = VK_PIPELINE_STAGE_TRANSFER_BIT,
-                .srcAccessMask = 0,
-                .dstStageMask  = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-            },
-            {
-                .srcSubpass    = 0,
-                .dstSubpass    = VK_SUBPASS_EXTERNAL,
-                .srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-                .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-                .dstStageMask  = VK_PIPELINE_STAGE_TRANSFER_BIT,
-                .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-            }};
-
-        const VkAttachmentDescription attachments[] = {srcAttachment,
-                                                       dstAttachment};
+    for (int i = 0; i < DALI_FRAMES_IN_FLIGHT; i++)
+    {
+        Frame* frame = &engine->frames[i];
 
-        VkRenderPassCreateInfo ci = {
-            .sType           = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-            .subpassCount    = 1,
-            .pSubpasses      = &subpass,
-            .attachmentCount = LEN(attachments),
-            .pAttachments    = attachments,
-            .dependencyCount = LEN(dependencies),
-            .pDependencies   = dependencies,
-        };
+        frame->matrixRegion = obdn_RequestBufferRegion(
+            engine->memory, sizeof(UboMatrices),
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
 
-        V_ASSERT(vkCreateRenderPass(engine->device, &ci, NULL,
-                                    &engine->singleCompositeRenderPass));
+        frame->brushRegion = obdn_RequestBufferRegion(
+            engine->memory, sizeof(UboBrush),
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
+
+        frame->dirtyTileRegion = obdn_RequestBufferRegion(
+            engine->memory, sizeof(uint32_t) * engine->tileCount,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
+        memset(frame->dirtyTileRegion.hostData, 0, frame->dirtyTileRegion.size);
+
+        frame->dabRegion = obdn_RequestBufferRegion(
+            engine->memory, sizeof(Vec2) * MAX_DABS,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
+
+        frame->dabBoundsRegion = obdn_RequestBufferRegion(
+            engine->memory, sizeof(int32_t) * 4 * (MAX_DABS + 1),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
+
+        requestFrameLayerRegions(engine, frame);
     }
 }
 
+// makes room in the staging buffer for count tiles. the last drain must be
+// done, since a buffer that grows is replaced.
 static void
-initUniformBuffers(Engine* engine)
+reserveStagingTiles(Engine* engine, const uint32_t count)
 {
-    engine->matrixRegion = obdn_RequestBufferRegion(
-        engine->memory, sizeof(UboMatrices), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
-    UboMatrices* matrices = (UboMatrices*)engine->matrixRegion.hostData;
-    matrices->model       = coal_Ident_Mat4();
-    matrices->view        = coal_Ident_Mat4();
-    matrices->proj        = coal_Ident_Mat4();
-    matrices->viewInv     = coal_Ident_Mat4();
-    matrices->projInv     = coal_Ident_Mat4();
-
-    engine->brushRegion = obdn_RequestBufferRegion(
-        engine->memory, sizeof(UboBrush), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
+    const VkDeviceSize tileSize =
+        DALI_TILE_SIZE * DALI_TILE_SIZE * DALI_TEXEL_SIZE;
+    if (engine->stagingRegion.size >= count * tileSize)
+        return;
+    uint32_t capacity = engine->stagingRegion.size
+                            ? engine->stagingRegion.size / tileSize
+                            : MIN_STAGING_TILES;
+    while (capacity < count)
+        capacity *= 2;
+    capacity = MIN(capacity, engine->tileCount);
+
+    if (engine->stagingRegion.size)
+        obdn_FreeBufferRegion(&engine->stagingRegion);
+    engine->stagingRegion = obdn_RequestBufferRegion(
+        engine->memory, capacity * tileSize,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        OBDN_V_MEMORY_DEVICE_TYPE);
 }
 
 static void
 initDescSetsAndPipeLayouts(Engine* engine)
 {
     Obdn_DescriptorBinding bindingsA[] = {
-        {// uv buffer
-         .descriptorCount = 1,
-         .type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-         .stageFlags      = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR},
-        {// index buffer
+        {// prim table
          .descriptorCount = 1,
          .type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
          .stageFlags      = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR},
@@ -516,34 +601,58 @@ initDescSetsAndPipeLayouts(Engine* engine)
         {// brush
          .descriptorCount = 1,
          .type            = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-         .stageFlags      = VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+         .stageFlags      = VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+                       VK_SHADER_STAGE_FRAGMENT_BIT},
         {// paint image
          .descriptorCount = 1,
          .type            = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-         .stageFlags      = VK_SHADER_STAGE_RAYGEN_BIT_KHR}};
+         .stageFlags      = VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+                       VK_SHADER_STAGE_VERTEX_BIT},
+        {// dirty tiles
+         .descriptorCount = 1,
+         .type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .stageFlags      = VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+        {// dabs
+         .descriptorCount = 1,
+         .type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .stageFlags      = VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+        {// dab bounds
+         .descriptorCount = 1,
+         .type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .stageFlags      = VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+                       VK_SHADER_STAGE_VERTEX_BIT},
+        {// layer table
+         .descriptorCount = 1,
+         .type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT},
+        {// tile occupancy
+         .descriptorCount = 1,
+         .type            = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT}};
 
     Obdn_DescriptorBinding bindingsC[] = {
-        {
-            .descriptorCount = 1,
-            .type            = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-            .stageFlags      = VK_SHADER_STAGE_FRAGMENT_BIT,
-        },
-        {
-            .descriptorCount = 1,
-            .type            = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-            .stageFlags      = VK_SHADER_STAGE_FRAGMENT_BIT,
-        },
-        {
-            .descriptorCount = 1,
-            .type            = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-            .stageFlags      = VK_SHADER_STAGE_FRAGMENT_BIT,
-        },
-        {
+        {// stamp
             .descriptorCount = 1,
             .type            = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
             .stageFlags      = VK_SHADER_STAGE_FRAGMENT_BIT,
         }};
 
+    Obdn_DescriptorBinding bindingsD[] = {
+        {// layer images. only as many as the pool has slots are ever written,
+         // and a new slot is written while frames are in flight.
+         .descriptorCount = COMP_IMAGE_SLOTS + engine->slotCapacity,
+         .type            = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+         .stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT,
+         .bindingFlags    = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                         VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT},
+        {// composite and flat images. the flat images are written as they
+         // are created.
+         .descriptorCount = COMP_TARGET_COUNT,
+         .type            = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+         .stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT,
+         .bindingFlags    = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                         VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT}};
+
     const Obdn_DescriptorSetInfo descSets[] = {
         {
             .bindingCount = LEN(bindingsA),
@@ -555,7 +664,10 @@ initDescSetsAndPipeLayouts(Engine* engine)
         },
         {// comp
          .bindingCount = LEN(bindingsC),
-         .bindings     = bindingsC}};
+         .bindings     = bindingsC},
+        {// layers
+         .bindingCount = LEN(bindingsD),
+         .bindings     = bindingsD}};
 
     obdn_CreateDescriptorSetLayouts(engine->device, LEN(descSets), descSets,
                                     engine->descriptorSetLayouts);
@@ -564,22 +676,41 @@ initDescSetsAndPipeLayouts(Engine* engine)
                               engine->descriptorSetLayouts,
                               &engine->description);
 
-    VkPushConstantRange pcRange = {.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
-                                   .offset     = 0,
-                                   .size       = sizeof(float) * 4};
+    Obdn_DescriptorSetInfo frameSets[DALI_FRAMES_IN_FLIGHT];
+    VkDescriptorSetLayout  frameLayouts[DALI_FRAMES_IN_FLIGHT];
+    for (int i = 0; i < DALI_FRAMES_IN_FLIGHT; i++)
+    {
+        frameSets[i]    = descSets[DESC_SET_PAINT];
+        frameLayouts[i] = engine->descriptorSetLayouts[DESC_SET_PAINT];
+    }
+
+    obdn_CreateDescriptorSets(engine->device, DALI_FRAMES_IN_FLIGHT, frameSets,
+                              frameLayouts, &engine->frameDescription);
+
+    for (int i = 0; i < DALI_FRAMES_IN_FLIGHT; i++)
+        engine->frames[i].descriptorSet =
+            engine->frameDescription.descriptorSets[i];
+
+    VkPushConstantRange pcRanges[] = {
+        {.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+         .offset     = 0,
+         .size       = sizeof(float) * 2},
+        {.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+         .offset     = COMP_BATCH_OFFSET,
+         .size       = sizeof(CompBatch)}};
 
     const Obdn_PipelineLayoutInfo pipeLayoutInfos[] = {
         {.descriptorSetCount   = LEN(descSets),
          .descriptorSetLayouts = engine->descriptorSetLayouts,
-         .pushConstantCount    = 1,
-         .pushConstantsRanges  = &pcRange}};
+         .pushConstantCount    = LEN(pcRanges),
+         .pushConstantsRanges  = pcRanges}};
 
     obdn_CreatePipelineLayouts(engine->device, LEN(pipeLayoutInfos),
                                pipeLayoutInfos, &engine->pipelineLayout);
 }
 
 static void
-updateDescSetPrim(Engine* engine, const Obdn_Scene* scene)
+updateDescSetPrim(Engine* engine)
 {
     VkWriteDescriptorSetAccelerationStructureKHR asInfo = {
         .sType =
@@ -587,18 +718,10 @@ updateDescSetPrim(Engine* engine, const Obdn_Scene* scene)
         .accelerationStructureCount = 1,
         .pAccelerationStructures    = &engine->topLevelAS.handle};
 
-    Obdn_Primitive* prim = obdn_GetPrimitive(scene, 0);
-
-    VkDescriptorBufferInfo uvBufInfo = {
-        .offset = obdn_GetAttrOffset(&prim->geo, "uv"),
-        .range  = obdn_GetAttrRange(&prim->geo, "uv"),
-        .buffer = prim->geo.vertexRegion.buffer,
-    };
-
-    VkDescriptorBufferInfo indexBufInfo = {
-        .offset = prim->geo.indexRegion.offset,
-        .range  = prim->geo.indexRegion.size,
-        .buffer = prim->geo.indexRegion.buffer,
+    VkDescriptorBufferInfo primTableInfo = {
+        .offset = engine->primTableRegion.offset,
+        .range  = engine->primTableRegion.size,
+        .buffer = engine->primTableRegion.buffer,
     };
 
     VkWriteDescriptorSet writes[] = {
@@ -608,19 +731,12 @@ updateDescSetPrim(Engine* engine, const Obdn_Scene* scene)
          .dstBinding      = 0,
          .descriptorCount = 1,
          .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-         .pBufferInfo     = &uvBufInfo},
+         .pBufferInfo     = &primTableInfo},
         {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
          .dstArrayElement = 0,
          .dstSet          = engine->description.descriptorSets[DESC_SET_PRIM],
          .dstBinding      = 1,
          .descriptorCount = 1,
-         .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-         .pBufferInfo     = &indexBufInfo},
-        {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-         .dstArrayElement = 0,
-         .dstSet          = engine->description.descriptorSets[DESC_SET_PRIM],
-         .dstBinding      = 2,
-         .descriptorCount = 1,
          .descriptorType  = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
          .pNext           = &asInfo}};
 
@@ -628,72 +744,172 @@ updateDescSetPrim(Engine* engine, const Obdn_Scene* scene)
 }
 
 static void
-updateDescSetPaint(Engine* engine)
+updateDescSetPaint(Engine* engine, const Frame* frame)
 {
     VkDescriptorBufferInfo uniformInfoMatrices = {
-        .range  = engine->matrixRegion.size,
-        .offset = engine->matrixRegion.offset,
-        .buffer = engine->matrixRegion.buffer,
+        .range  = frame->matrixRegion.size,
+        .offset = frame->matrixRegion.offset,
+        .buffer = frame->matrixRegion.buffer,
     };
 
     VkDescriptorBufferInfo uniformInfoBrush = {
-        .range  = engine->brushRegion.size,
-        .offset = engine->brushRegion.offset,
-        .buffer = engine->brushRegion.buffer,
+        .range  = frame->brushRegion.size,
+        .offset = frame->brushRegion.offset,
+        .buffer = frame->brushRegion.buffer,
     };
 
     VkDescriptorImageInfo imageInfo = {.imageLayout = VK_IMAGE_LAYOUT_GENERAL,
-                                       .imageView   = engine->imageA.view,
-                                       .sampler     = engine->imageA.sampler};
+                                       .imageView   = engine->stampImage.view,
+                                       .sampler     = engine->stampImage.sampler};
+
+    VkDescriptorBufferInfo dirtyTileInfo = {
+        .range  = frame->dirtyTileRegion.size,
+        .offset = frame->dirtyTileRegion.offset,
+        .buffer = frame->dirtyTileRegion.buffer,
+    };
+
+    VkDescriptorBufferInfo dabInfo = {
+        .range  = frame->dabRegion.size,
+        .offset = frame->dabRegion.offset,
+        .buffer = frame->dabRegion.buffer,
+    };
+
+    VkDescriptorBufferInfo dabBoundsInfo = {
+        .range  = frame->dabBoundsRegion.size,
+        .offset = frame->dabBoundsRegion.offset,
+        .buffer = frame->dabBoundsRegion.buffer,
+    };
+
+    VkDescriptorBufferInfo layerTableInfo = {
+        .range  = frame->layerTableRegion.size,
+        .offset = frame->layerTableRegion.offset,
+        .buffer = frame->layerTableRegion.buffer,
+    };
+
+    VkDescriptorBufferInfo occupancyInfo = {
+        .range  = frame->occupancyRegion.size,
+        .offset = frame->occupancyRegion.offset,
+        .buffer = frame->occupancyRegion.buffer,
+    };
 
     VkWriteDescriptorSet writes[] = {
         {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
          .dstArrayElement = 0,
-         .dstSet          = engine->description.descriptorSets[DESC_SET_PAINT],
+         .dstSet          = frame->descriptorSet,
          .dstBinding      = 0,
          .descriptorCount = 1,
          .descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
          .pBufferInfo     = &uniformInfoMatrices},
         {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
          .dstArrayElement = 0,
-         .dstSet          = engine->description.descriptorSets[DESC_SET_PAINT],
+         .dstSet          = frame->descriptorSet,
          .dstBinding      = 1,
          .descriptorCount = 1,
          .descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
          .pBufferInfo     = &uniformInfoBrush},
         {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
          .dstArrayElement = 0,
-         .dstSet          = engine->description.descriptorSets[DESC_SET_PAINT],
+         .dstSet          = frame->descriptorSet,
          .dstBinding      = 2,
          .descriptorCount = 1,
          .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-         .pImageInfo      = &imageInfo}};
-
-    vkUpdateDescriptorSets(engine->device, LEN(writes), writes, 0, NULL);
-}
-
-static void
-updateDescSetComp(Engine* engine)
-{
-    VkDescriptorImageInfo imageInfoA = {
-        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        .imageView   = engine->imageA.view,
-        .sampler     = engine->imageA.sampler};
+         .pImageInfo      = &imageInfo},
+        {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .dstArrayElement = 0,
+         .dstSet          = frame->descriptorSet,
+         .dstBinding      = 3,
+         .descriptorCount = 1,
+         .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .pBufferInfo     = &dirtyTileInfo},
+        {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .dstArrayElement = 0,
+         .dstSet          = frame->descriptorSet,
+         .dstBinding      = 4,
+         .descriptorCount = 1,
+         .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .pBufferInfo     = &dabInfo},
+        {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .dstArrayElement = 0,
+         .dstSet          = frame->descriptorSet,
+         .dstBinding      = 5,
+         .descriptorCount = 1,
+         .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .pBufferInfo     = &dabBoundsInfo},
+        {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .dstArrayElement = 0,
+         .dstSet          = frame->descriptorSet,
+         .dstBinding      = 6,
+         .descriptorCount = 1,
+         .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .pBufferInfo     = &layerTableInfo},
+        {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .dstArrayElement = 0,
+         .dstSet          = frame->descriptorSet,
+         .dstBinding      = 7,
+         .descriptorCount = 1,
+         .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .pBufferInfo     = &occupancyInfo}};
+
+    vkUpdateDescriptorSets(engine->device, LEN(writes), writes, 0, NULL);
+}
+
+// makes room in the composite's tables and the slot map for count layers
+static void
+reserveLayers(Engine* engine, const uint16_t count)
+{
+    if (count <= engine->layerCapacity)
+        return;
+    uint32_t capacity =
+        engine->layerCapacity ? engine->layerCapacity : MIN_COMP_LAYERS;
+    while (capacity < count)
+        capacity *= 2;
+    capacity = MIN(capacity, UINT16_MAX);
+
+    engine->layerTable =
+        realloc(engine->layerTable, sizeof(CompLayerTable) +
+                                        sizeof(CompLayer) *
+                                            COMP_TABLE_SIZE(capacity));
+    engine->compLayers = realloc(engine->compLayers,
+                                 sizeof(Dali_LayerId) * COMP_TABLE_SIZE(capacity));
+    engine->layerSlots = realloc(engine->layerSlots, sizeof(int16_t) * capacity);
+    assert(engine->layerTable);
+    assert(engine->compLayers);
+    assert(engine->layerSlots);
+    for (uint32_t l = engine->layerCapacity; l < capacity; l++)
+        engine->layerSlots[l] = -1;
+    engine->layerCapacity = capacity;
+}
+
+// catches the frame's layer table and occupancy up with the engine's layer
+// capacity. the frame's commands must have completed.
+static void
+reserveFrameLayers(Engine* engine, Frame* frame)
+{
+    if (frame->layerCapacity == engine->layerCapacity)
+        return;
+    obdn_FreeBufferRegion(&frame->layerTableRegion);
+    obdn_FreeBufferRegion(&frame->occupancyRegion);
+    requestFrameLayerRegions(engine, frame);
+    updateDescSetPaint(engine, frame);
+}
+
+static void
+updateDescSetComp(Engine* engine)
+{
+    VkDescriptorImageInfo imageInfoStamp = {
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .imageView   = engine->stampImage.view,
+        .sampler     = engine->stampImage.sampler};
 
     VkDescriptorImageInfo imageInfoB = {
         .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
         .imageView   = engine->imageB.view,
         .sampler     = engine->imageB.sampler};
 
-    VkDescriptorImageInfo imageInfoC = {
-        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        .imageView   = engine->imageC.view,
-        .sampler     = engine->imageC.sampler};
-
-    VkDescriptorImageInfo imageInfoD = {
-        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        .imageView   = engine->imageD.view,
-        .sampler     = engine->imageD.sampler};
+    VkDescriptorImageInfo imageInfoA = {
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .imageView   = engine->imageA.view,
+        .sampler     = engine->imageA.sampler};
 
     VkWriteDescriptorSet writes[] = {
         {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
@@ -702,32 +918,77 @@ updateDescSetComp(Engine* engine)
          .dstBinding      = 0,
          .descriptorCount = 1,
          .descriptorType  = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-         .pImageInfo      = &imageInfoA},
+         .pImageInfo      = &imageInfoStamp},
+        {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .dstArrayElement = COMP_IMAGE_ACTIVE,
+         .dstSet          = engine->description.descriptorSets[DESC_SET_LAYERS],
+         .dstBinding      = 0,
+         .descriptorCount = 1,
+         .descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+         .pImageInfo      = &imageInfoB},
         {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
          .dstArrayElement = 0,
-         .dstSet          = engine->description.descriptorSets[DESC_SET_COMP],
+         .dstSet          = engine->description.descriptorSets[DESC_SET_LAYERS],
          .dstBinding      = 1,
          .descriptorCount = 1,
-         .descriptorType  = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-         .pImageInfo      = &imageInfoC},
+         .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+         .pImageInfo      = &imageInfoA}};
+
+    vkUpdateDescriptorSets(engine->device, LEN(writes), writes, 0, NULL);
+}
+
+// the frames in flight do not index a flat image that was just created, which
+// is what lets it be written under them
+static void
+updateDescSetFlatImage(Engine* engine, const uint32_t flat)
+{
+    VkDescriptorImageInfo imageInfo = {
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .imageView   = engine->flatImages[flat].image.view,
+        .sampler     = engine->flatImages[flat].image.sampler};
+
+    VkWriteDescriptorSet writes[] = {
         {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-         .dstArrayElement = 0,
-         .dstSet          = engine->description.descriptorSets[DESC_SET_COMP],
-         .dstBinding      = 2,
+         .dstArrayElement = COMP_IMAGE_FLAT + flat,
+         .dstSet          = engine->description.descriptorSets[DESC_SET_LAYERS],
+         .dstBinding      = 0,
          .descriptorCount = 1,
-         .descriptorType  = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-         .pImageInfo      = &imageInfoB},
+         .descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+         .pImageInfo      = &imageInfo},
         {.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-         .dstArrayElement = 0,
-         .dstSet          = engine->description.descriptorSets[DESC_SET_COMP],
-         .dstBinding      = 3,
+         .dstArrayElement = COMP_TARGET_FLAT + flat,
+         .dstSet          = engine->description.descriptorSets[DESC_SET_LAYERS],
+         .dstBinding      = 1,
          .descriptorCount = 1,
-         .descriptorType  = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
-         .pImageInfo      = &imageInfoD}};
+         .descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+         .pImageInfo      = &imageInfo}};
 
     vkUpdateDescriptorSets(engine->device, LEN(writes), writes, 0, NULL);
 }
 
+// the set is updated in place, which UPDATE_UNUSED_WHILE_PENDING allows
+// while frames are in flight as long as none of them uses the element: the
+// slot must be new, or one no pending frame reads
+static void
+updateDescSetLayerImage(Engine* engine, const uint32_t slot)
+{
+    VkDescriptorImageInfo imageInfo = {
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .imageView   = engine->layerPool.slots[slot].view,
+        .sampler     = engine->layerPool.slots[slot].sampler};
+
+    VkWriteDescriptorSet write = {
+        .sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstArrayElement = COMP_IMAGE_SLOTS + slot,
+        .dstSet          = engine->description.descriptorSets[DESC_SET_LAYERS],
+        .dstBinding      = 0,
+        .descriptorCount = 1,
+        .descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo      = &imageInfo};
+
+    vkUpdateDescriptorSets(engine->device, 1, &write, 0, NULL);
+}
+
 static void
 initPaintPipelineAndShaderBindingTable(Engine* engine)
 {
@@ -747,17 +1008,27 @@ initPaintPipelineAndShaderBindingTable(Engine* engine)
          .chitCount   = 1,
          .chitShaders = (char*[]){SPVDIR "/paint.rchit.spv"}}};
 
-    obdn_CreateRayTracePipelines(
-        engine->device, engine->memory, LEN(pipeInfosRT), pipeInfosRT,
-        &engine->paintPipeline, &engine->shaderBindingTable);
+    dali_CreateRayTracePipelines(engine->instance, engine->memory,
+                                 engine->pipelineCache, LEN(pipeInfosRT),
+                                 pipeInfosRT, &engine->paintPipeline,
+                                 &engine->shaderBindingTable);
+}
+
+static VkPipeline
+applyPipeline(const Engine* engine)
+{
+    assert(engine->paintMode < PAINT_MODE_COUNT);
+    return engine->compPipelines[PIPELINE_APPLY_OVER + engine->paintMode];
 }
 
 static void
-initCompPipelines(Engine* engine, const Obdn_R_BlendMode blendMode)
+initCompPipelines(Engine* engine)
 {
-    assert(blendMode != OBDN_R_BLEND_MODE_NONE);
+    _Static_assert(PIPELINE_APPLY_ERASE - PIPELINE_APPLY_OVER ==
+                       PAINT_MODE_ERASE - PAINT_MODE_OVER,
+                   "apply pipelines must be in paint mode order");
 
-    const Obdn_GraphicsPipelineInfo pipeInfo1 = {
+    const Obdn_GraphicsPipelineInfo pipeInfoOver = {
         .layout            = engine->pipelineLayout,
         .renderPass        = engine->applyPaintRenderPass,
         .subpass           = 0,
@@ -765,74 +1036,38 @@ initCompPipelines(Engine* engine, const Obdn_R_BlendMode blendMode)
         .sampleCount       = VK_SAMPLE_COUNT_1_BIT,
         .primitiveTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
         .viewportDim       = {engine->textureSize, engine->textureSize},
-        .blendMode         = blendMode,
-        .vertShader        = OBDN_FULL_SCREEN_VERT_SPV,
-        .fragShader        = SPVDIR "/comp.frag.spv"};
+        .blendMode         = OBDN_R_BLEND_MODE_OVER,
+        .vertShader        = SPVDIR "/dab.vert.spv",
+        .fragShader        = SPVDIR "/stamp.frag.spv"};
 
-    const Obdn_GraphicsPipelineInfo pipeInfo2 = {
-        .layout            = engine->pipelineLayout,
-        .renderPass        = engine->compositeRenderPass,
-        .subpass           = 0,
-        .frontFace         = VK_FRONT_FACE_CLOCKWISE,
-        .sampleCount       = VK_SAMPLE_COUNT_1_BIT,
-        .primitiveTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-        .viewportDim       = {engine->textureSize, engine->textureSize},
-        .blendMode         = OBDN_R_BLEND_MODE_OVER_STRAIGHT,
-        .vertShader        = OBDN_FULL_SCREEN_VERT_SPV,
-        .fragShader        = SPVDIR "/comp2a.frag.spv"};
+    Obdn_GraphicsPipelineInfo pipeInfoErase = pipeInfoOver;
+    pipeInfoErase.blendMode                 = OBDN_R_BLEND_MODE_ERASE;
 
-    const Obdn_GraphicsPipelineInfo pipeInfo3 = {
+    const Obdn_GraphicsPipelineInfo pipeInfoClear = {
         .layout            = engine->pipelineLayout,
-        .renderPass        = engine->compositeRenderPass,
+        .renderPass        = engine->applyPaintRenderPass,
         .subpass           = 1,
         .frontFace         = VK_FRONT_FACE_CLOCKWISE,
         .sampleCount       = VK_SAMPLE_COUNT_1_BIT,
         .primitiveTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
         .viewportDim       = {engine->textureSize, engine->textureSize},
-        .blendMode         = OBDN_R_BLEND_MODE_OVER_STRAIGHT,
-        .vertShader        = OBDN_FULL_SCREEN_VERT_SPV,
-        .fragShader        = SPVDIR "/comp3a.frag.spv"};
+        .blendMode         = OBDN_R_BLEND_MODE_NONE,
+        .vertShader        = SPVDIR "/dab.vert.spv",
+        .fragShader        = SPVDIR "/clearStamp.frag.spv"};
 
-    const Obdn_GraphicsPipelineInfo pipeInfo4 = {
-        .layout            = engine->pipelineLayout,
-        .renderPass        = engine->compositeRenderPass,
-        .subpass           = 2,
-        .frontFace         = VK_FRONT_FACE_CLOCKWISE,
-        .sampleCount       = VK_SAMPLE_COUNT_1_BIT,
-        .primitiveTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-        .viewportDim       = {engine->textureSize, engine->textureSize},
-        .blendMode         = OBDN_R_BLEND_MODE_OVER_STRAIGHT,
-        .vertShader        = OBDN_FULL_SCREEN_VERT_SPV,
-        .fragShader        = SPVDIR "/comp4a.frag.spv"};
-
-    const Obdn_GraphicsPipelineInfo pipeInfoSingle = {
-        .layout            = engine->pipelineLayout,
-        .renderPass        = engine->singleCompositeRenderPass,
-        .subpass           = 0,
-        .frontFace         = VK_FRONT_FACE_CLOCKWISE,
-        .sampleCount       = VK_SAMPLE_COUNT_1_BIT,
-        .primitiveTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-        .viewportDim       = {engine->textureSize, engine->textureSize},
-        .blendMode         = OBDN_R_BLEND_MODE_OVER_STRAIGHT,
-        .vertShader        = OBDN_FULL_SCREEN_VERT_SPV,
-        .fragShader        = SPVDIR "/comp.frag.spv"};
-
-    const Obdn_GraphicsPipelineInfo infos[] = {pipeInfo1, pipeInfo2, pipeInfo3,
-                                               pipeInfo4, pipeInfoSingle};
+    // one call lets the driver compile them in parallel
+    const Obdn_GraphicsPipelineInfo infos[] = {pipeInfoOver, pipeInfoErase,
+                                               pipeInfoClear};
 
     assert(LEN(infos) == PIPELINE_COMP_COUNT);
 
-    obdn_CreateGraphicsPipelines(engine->device, LEN(infos), infos,
-                                 engine->compPipelines);
-}
+    dali_CreateGraphicsPipelines(engine->device, engine->pipelineCache,
+                                 LEN(infos), infos, engine->compPipelines);
 
-static void
-destroyCompPipelines(Engine* engine)
-{
-    for (int i = PIPELINE_COMP_1; i < PIPELINE_COMP_COUNT; i++)
-    {
-        vkDestroyPipeline(engine->device, engine->compPipelines[i], NULL);
-    }
+    dali_CreateComputePipeline(engine->device, engine->pipelineCache,
+                               engine->pipelineLayout,
+                               SPVDIR "/composite.comp.spv",
+                               &engine->compositePipeline);
 }
 
 static void
@@ -841,7 +1076,7 @@ initFramebuffers(Engine* engine)
     // applyPaintFrameBuffer
     {
         const VkImageView attachments[] = {
-            engine->imageA.view,
+            engine->stampImage.view,
             engine->imageB.view,
         };
 
@@ -857,81 +1092,17 @@ initFramebuffers(Engine* engine)
         V_ASSERT(vkCreateFramebuffer(engine->device, &info, NULL,
                                      &engine->applyPaintFrameBuffer));
     }
-
-    // compositeFrameBuffer
-    {
-        const VkImageView attachments[] = {
-            engine->imageB.view, engine->imageC.view, engine->imageD.view,
-            engine->imageA.view};
-
-        VkFramebufferCreateInfo info = {
-            .sType           = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .layers          = 1,
-            .height          = engine->textureSize,
-            .width           = engine->textureSize,
-            .renderPass      = engine->compositeRenderPass,
-            .attachmentCount = 4,
-            .pAttachments    = attachments};
-
-        V_ASSERT(vkCreateFramebuffer(engine->device, &info, NULL,
-                                     &engine->compositeFrameBuffer));
-    }
-
-    // backgroundFrameBuffer
-    {
-        const VkImageView attachments[] = {
-            engine->imageA.view,
-            engine->imageC.view,
-        };
-
-        VkFramebufferCreateInfo info = {
-            .sType           = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .layers          = 1,
-            .height          = engine->textureSize,
-            .width           = engine->textureSize,
-            .renderPass      = engine->singleCompositeRenderPass,
-            .attachmentCount = 2,
-            .pAttachments    = attachments};
-
-        V_ASSERT(vkCreateFramebuffer(engine->device, &info, NULL,
-                                     &engine->backgroundFrameBuffer));
-    }
-
-    // foregroundFrameBuffer
-    {
-        const VkImageView attachments[] = {
-            engine->imageA.view,
-            engine->imageD.view,
-        };
-
-        VkFramebufferCreateInfo info = {
-            .sType           = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .layers          = 1,
-            .height          = engine->textureSize,
-            .width           = engine->textureSize,
-            .renderPass      = engine->singleCompositeRenderPass,
-            .attachmentCount = 2,
-            .pAttachments    = attachments};
-
-        V_ASSERT(vkCreateFramebuffer(engine->device, &info, NULL,
-                                     &engine->foregroundFrameBuffer));
-    }
 }
 
 static void
-onLayerChange(Engine* engine, Dali_LayerStack* stack, Dali_LayerId newLayerId)
+cmdUploadLayer(Engine* engine, const VkCommandBuffer cmdBuf,
+               const Dali_LayerStack* stack, const Dali_LayerId id,
+               const VkImage image)
 {
-    hell_DebugPrint(PAINT_DEBUG_TAG_PAINT, "Begin\n");
-
-    Obdn_V_Command cmd =
-        obdn_CreateCommand(engine->instance, OBDN_V_QUEUE_GRAPHICS_TYPE);
-
-    obdn_BeginCommandBuffer(cmd.buffer);
-
-    BufferRegion* prevLayerBuffer =
-        &dali_GetLayer(stack, engine->curLayerId)->bufferRegion;
-
-    VkImageSubresourceRange subResRange = {
+    // image is expected to be in TRANSFER_DST_OPTIMAL. empty tiles are
+    // cleared rather than copied from the shared empty tile.
+    engine->uploadCount++;
+    const VkImageSubresourceRange subResRange = {
         .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
         .baseArrayLayer = 0,
         .baseMipLevel   = 0,
@@ -939,329 +1110,914 @@ onLayerChange(Engine* engine, Dali_LayerStack* stack, Dali_LayerId newLayerId)
         .layerCount     = 1,
     };
 
-    VkClearColorValue clearColor = {
+    const VkClearColorValue clearColor = {
         .float32[0] = 0,
         .float32[1] = 0,
         .float32[2] = 0,
         .float32[3] = 0,
     };
 
-    VkImageMemoryBarrier barriers[] = {
-        {.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-         .image            = engine->imageA.handle,
-         .oldLayout        = engine->imageA.layout,
-         .newLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-         .subresourceRange = subResRange,
-         .srcAccessMask    = 0,
-         .dstAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT},
-        {.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-         .image            = engine->imageB.handle,
-         .oldLayout        = engine->imageB.layout,
-         .newLayout        = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-         .subresourceRange = subResRange,
-         .srcAccessMask    = 0,
-         .dstAccessMask    = VK_ACCESS_TRANSFER_READ_BIT},
-        {.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-         .image            = engine->imageC.handle,
-         .oldLayout        = engine->imageC.layout,
-         .newLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-         .subresourceRange = subResRange,
-         .srcAccessMask    = 0,
-         .dstAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT},
-        {.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-         .image            = engine->imageD.handle,
-         .oldLayout        = engine->imageD.layout,
-         .newLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-         .subresourceRange = subResRange,
-         .srcAccessMask    = 0,
-         .dstAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT}};
-
-    vkCmdPipelineBarrier(cmd.buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL,
-                         LEN(barriers), barriers);
-
-    obdn_CmdCopyImageToBuffer(cmd.buffer, 0, &engine->imageB, prevLayerBuffer);
-
-    vkCmdClearColorImage(cmd.buffer, engine->imageC.handle,
-                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColor, 1,
-                         &subResRange);
-    vkCmdClearColorImage(cmd.buffer, engine->imageD.handle,
+    VkImageMemoryBarrier barrier = {
+        .sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .image            = image,
+        .oldLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .subresourceRange = subResRange,
+        .srcAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT};
+
+    // the image may still be read by a previous composite
+    vkCmdPipelineBarrier(cmdBuf,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
+                         &barrier);
+
+    vkCmdClearColorImage(cmdBuf, image,
                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColor, 1,
                          &subResRange);
 
-    VkImageMemoryBarrier barriers0[] = {
-        {.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-         .image            = engine->imageC.handle,
-         .oldLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-         .newLayout        = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-         .subresourceRange = subResRange,
-         .srcAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT,
-         .dstAccessMask    = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT},
-        {.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-         .image            = engine->imageD.handle,
-         .oldLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-         .newLayout        = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-         .subresourceRange = subResRange,
-         .srcAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT,
-         .dstAccessMask    = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT}};
-
-    vkCmdPipelineBarrier(cmd.buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0,
-                         NULL, 0, NULL, LEN(barriers0), barriers0);
-
-    engine->curLayerId = newLayerId;
-
-    for (int l = 0; l < engine->curLayerId; l++)
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
+                         &barrier);
+
+    const uint32_t tilesPerSide = dali_GetLayerTilesPerSide(stack);
+    const uint32_t tileCount    = dali_GetLayerTileCount(stack);
+    for (uint32_t t = 0; t < tileCount; t++)
     {
-        BufferRegion* layerBuffer = &dali_GetLayer(stack, l)->bufferRegion;
+        if (dali_LayerTileIsEmpty(stack, id, t))
+            continue;
+        const BufferRegion*     tile   = dali_GetLayerTile(stack, id, t);
+        const VkBufferImageCopy region = {
+            .bufferOffset      = tile->offset,
+            .bufferRowLength   = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource  = {.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+                                 .mipLevel       = 0,
+                                 .baseArrayLayer = 0,
+                                 .layerCount     = 1},
+            .imageOffset       = {(t % tilesPerSide) * DALI_TILE_SIZE,
+                            (t / tilesPerSide) * DALI_TILE_SIZE, 0},
+            .imageExtent       = {DALI_TILE_SIZE, DALI_TILE_SIZE, 1}};
+        vkCmdCopyBufferToImage(cmdBuf, tile->buffer, image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    }
+}
 
-        obdn_CmdCopyBufferToImage(cmd.buffer, 0, layerBuffer, &engine->imageA);
+// folds the tiles paint.rgen has marked into the engine's dirty set. the
+// paint commands that wrote them must have completed. returns true if any
+// tile was marked.
+static bool
+collectDirtyTiles(Engine* engine, Frame* frame)
+{
+    uint32_t* marks = (uint32_t*)frame->dirtyTileRegion.hostData;
+    bool      any   = false;
+    for (uint32_t t = 0; t < engine->tileCount; t++)
+    {
+        if (marks[t])
+        {
+            engine->dirtyTiles[t] = true;
+            marks[t]              = 0;
+            any                   = true;
+        }
+    }
+    return any;
+}
 
-        VkClearValue clear = {0.0f, 0.903f, 0.009f, 1.0f};
+// moves the stack's copy of each dirty tile into a new undo entry and queues
+// a write back of imageB into a fresh region. returns the number of tiles
+// queued.
+static uint32_t
+journalDirtyTiles(Engine* engine, Dali_LayerStack* stack, Dali_UndoManager* undo,
+                  const Dali_LayerId id)
+{
+    engine->transferCount = 0;
+    if (!memchr(engine->dirtyTiles, true, sizeof(bool) * engine->tileCount))
+        return 0;
+    dali_BeginUndoEntry(undo, id);
+    for (uint32_t t = 0; t < engine->tileCount; t++)
+    {
+        if (!engine->dirtyTiles[t])
+            continue;
+        const BufferRegion old = dali_DetachLayerTile(stack, id, t);
+        dali_RecordUndoTile(undo, t, &old);
+        engine->transferTiles[engine->transferCount]   = t;
+        engine->transferRegions[engine->transferCount] =
+            dali_AcquireLayerTile(stack, id, t);
+        engine->transferCount++;
+        engine->dirtyTiles[t]  = false;
+        engine->storedTiles[t] = true;
+    }
+    dali_EndUndoEntry(undo);
+    return engine->transferCount;
+}
 
-        const VkRenderPassBeginInfo rpass = {
-            .sType           = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-            .clearValueCount = 1,
-            .pClearValues    = &clear,
-            .renderArea  = {{0, 0}, {engine->textureSize, engine->textureSize}},
-            .renderPass  = engine->singleCompositeRenderPass,
-            .framebuffer = engine->backgroundFrameBuffer,
-        };
+// copies the queued tiles between imageB and their regions. imageB must be in
+// TRANSFER_SRC_OPTIMAL if toHost, TRANSFER_DST_OPTIMAL otherwise. if staging
+// is given, tiles are read back into consecutive slots of it instead.
+static void
+cmdTransferTiles(Engine* engine, const VkCommandBuffer cmdBuf, const bool toHost,
+                 const BufferRegion* staging)
+{
+    const VkDeviceSize tileSize =
+        DALI_TILE_SIZE * DALI_TILE_SIZE * DALI_TEXEL_SIZE;
+    for (uint32_t i = 0; i < engine->transferCount; i++)
+    {
+        const uint32_t      t    = engine->transferTiles[i];
+        const BufferRegion* tile = engine->transferRegions[i];
+        const VkBuffer      buffer = staging ? staging->buffer : tile->buffer;
+        const VkBufferImageCopy region = {
+            .bufferOffset = staging ? staging->offset + i * tileSize
+                                    : tile->offset,
+            .bufferRowLength   = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource  = {.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+                                 .mipLevel       = 0,
+                                 .baseArrayLayer = 0,
+                                 .layerCount     = 1},
+            .imageOffset       = {(t % engine->tilesPerSide) * DALI_TILE_SIZE,
+                            (t / engine->tilesPerSide) * DALI_TILE_SIZE, 0},
+            .imageExtent       = {DALI_TILE_SIZE, DALI_TILE_SIZE, 1}};
+        if (toHost)
+            vkCmdCopyImageToBuffer(cmdBuf, engine->imageB.handle,
+                                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                   buffer, 1, &region);
+        else
+            vkCmdCopyBufferToImage(cmdBuf, buffer, engine->imageB.handle,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                                   &region);
+    }
+}
 
-        vkCmdBeginRenderPass(cmd.buffer, &rpass, VK_SUBPASS_CONTENTS_INLINE);
+// once the stored tiles have landed, tiles that were erased back to nothing
+// give up their memory
+static void
+trimStoredTiles(Engine* engine, Dali_LayerStack* stack, const Dali_LayerId id)
+{
+    for (uint32_t t = 0; t < engine->tileCount; t++)
+    {
+        if (!engine->storedTiles[t])
+            continue;
+        dali_TrimLayerTile(stack, id, t);
+        engine->storedTiles[t] = false;
+    }
+}
 
-        vkCmdBindDescriptorSets(
-            cmd.buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, engine->pipelineLayout,
-            DESC_SET_COMP, 1,
-            &engine->description.descriptorSets[DESC_SET_COMP], 0, NULL);
+static VkSemaphore
+createTimeline(VkDevice device)
+{
+    const VkSemaphoreTypeCreateInfo typeInfo = {
+        .sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue  = 0};
+
+    const VkSemaphoreCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &typeInfo};
+
+    VkSemaphore timeline;
+    V_ASSERT(vkCreateSemaphore(device, &info, NULL, &timeline));
+    return timeline;
+}
 
-        vkCmdBindPipeline(cmd.buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                          engine->compPipelines[PIPELINE_COMP_SINGLE]);
+static void
+waitTimeline(Engine* engine, VkSemaphore timeline, uint64_t value)
+{
+    const VkSemaphoreWaitInfo info = {
+        .sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores    = &timeline,
+        .pValues        = &value};
+    V_ASSERT(vkWaitSemaphores(engine->device, &info, UINT64_MAX));
+}
 
-        vkCmdDraw(cmd.buffer, 3, 1, 0, 0);
+static bool
+timelineReached(Engine* engine, VkSemaphore timeline, uint64_t value)
+{
+    uint64_t current;
+    V_ASSERT(vkGetSemaphoreCounterValue(engine->device, timeline, &current));
+    return current >= value;
+}
 
-        vkCmdEndRenderPass(cmd.buffer);
+static VkCommandBuffer
+beginSyncCommands(Engine* engine)
+{
+    if (!engine->syncRecording)
+    {
+        // the last sync submission is nearly always long done by now
+        waitTimeline(engine, engine->graphicsTimeline, engine->syncValue);
+        dali_CollectProfilerSlot(&engine->profiler, PROFILER_SLOT_SYNC);
+        obdn_ResetCommand(&engine->syncCommand);
+        obdn_BeginCommandBuffer(engine->syncCommand.buffer);
+        engine->syncRecording = true;
     }
+    return engine->syncCommand.buffer;
+}
 
-    const int layerCount = dali_GetLayerCount(stack);
+// submits what sync() recorded on the graphics queue, followed by the drain
+// of any backup on the transfer queue. returns false if nothing was recorded.
+static bool
+submitSyncCommands(Engine* engine)
+{
+    if (!engine->syncRecording)
+        return false;
+    engine->syncRecording = false;
+    obdn_EndCommandBuffer(engine->syncCommand.buffer);
+
+    // the last drain read the staging buffer we may be about to overwrite and
+    // wrote stack tiles we may be about to upload
+    const uint64_t             drainedValue = engine->transferValue;
+    const uint64_t             syncValue    = ++engine->graphicsValue;
+    const VkPipelineStageFlags syncStage    = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    engine->syncValue                       = syncValue;
+
+    const VkTimelineSemaphoreSubmitInfo syncValues = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount   = 1,
+        .pWaitSemaphoreValues      = &drainedValue,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues    = &syncValue};
+
+    const VkSubmitInfo syncSubmit = {
+        .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext                = &syncValues,
+        .waitSemaphoreCount   = 1,
+        .pWaitSemaphores      = &engine->transferTimeline,
+        .pWaitDstStageMask    = &syncStage,
+        .commandBufferCount   = 1,
+        .pCommandBuffers      = &engine->syncCommand.buffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores    = &engine->graphicsTimeline};
+
+    obdn_SubmitGraphicsCommands(engine->instance, 0, 1, &syncSubmit,
+                                VK_NULL_HANDLE);
+
+    if (engine->syncCaptured)
+    {
+        const uint64_t             drainValue = ++engine->transferValue;
+        const VkPipelineStageFlags drainStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+        const VkTimelineSemaphoreSubmitInfo drainValues = {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount   = 1,
+            .pWaitSemaphoreValues      = &syncValue,
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues    = &drainValue};
+
+        const VkSubmitInfo drainSubmit = {
+            .sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext                = &drainValues,
+            .waitSemaphoreCount   = 1,
+            .pWaitSemaphores      = &engine->graphicsTimeline,
+            .pWaitDstStageMask    = &drainStage,
+            .commandBufferCount   = 1,
+            .pCommandBuffers      = &engine->drainCommand.buffer,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores    = &engine->transferTimeline};
+
+        V_ASSERT(vkQueueSubmit(engine->transferQueue, 1, &drainSubmit,
+                               VK_NULL_HANDLE));
+        engine->syncCaptured = false;
+    }
+
+    return true;
+}
+
+// blocks until the stack's host tiles are no longer being written
+static void
+waitForDrain(Engine* engine)
+{
+    waitTimeline(engine, engine->transferTimeline, engine->transferValue);
+}
+
+// blocks until the paint commands of every frame in flight have completed
+static void
+waitForFrames(Engine* engine)
+{
+    for (int i = 0; i < DALI_FRAMES_IN_FLIGHT; i++)
+        waitTimeline(engine, engine->graphicsTimeline,
+                     engine->frames[i].doneValue);
+}
 
-    for (int l = engine->curLayerId + 1; l < layerCount; l++)
+// trims the tiles the last layer change stored once they have landed. only
+// blocks if asked to.
+static void
+finishTrim(Engine* engine, Dali_LayerStack* stack, const bool block)
+{
+    if (!engine->trimPending)
+        return;
+    if (block)
+        waitTimeline(engine, engine->graphicsTimeline, engine->trimValue);
+    else if (!timelineReached(engine, engine->graphicsTimeline,
+                              engine->trimValue))
+        return;
+    trimStoredTiles(engine, stack, engine->trimLayer);
+    engine->trimPending = false;
+}
+
+// where an image is read or written in each of the layouts the layer images,
+// the flat images and imageB move through
+static void
+layoutUse(const VkImageLayout layout, VkPipelineStageFlags* stage,
+          VkAccessFlags* access)
+{
+    switch (layout)
     {
-        BufferRegion* layerBuffer = &dali_GetLayer(stack, l)->bufferRegion;
+    case VK_IMAGE_LAYOUT_UNDEFINED:
+        // the contents are discarded
+        *stage  = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        *access = 0;
+        break;
+    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+        *stage  = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        *access = VK_ACCESS_TRANSFER_READ_BIT;
+        break;
+    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+        *stage  = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        *access = VK_ACCESS_TRANSFER_WRITE_BIT;
+        break;
+    case VK_IMAGE_LAYOUT_GENERAL:
+        // the flat images are written and read by the composite
+        *stage  = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        *access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        break;
+    default:
+        // read by the composite, and imageB is painted as an attachment
+        *stage  = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                 VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        *access = VK_ACCESS_SHADER_READ_BIT |
+                  VK_ACCESS_INPUT_ATTACHMENT_READ_BIT |
+                  VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                  VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        break;
+    }
+}
 
-        obdn_CmdCopyBufferToImage(cmd.buffer, 0, layerBuffer, &engine->imageA);
+static void
+cmdImageLayout(const VkCommandBuffer cmdBuf, const VkImage image,
+               const VkImageLayout oldLayout, const VkImageLayout newLayout)
+{
+    VkPipelineStageFlags srcStage, dstStage;
+    VkAccessFlags        srcAccess, dstAccess;
+    layoutUse(oldLayout, &srcStage, &srcAccess);
+    layoutUse(newLayout, &dstStage, &dstAccess);
 
-        VkClearValue clear = {0.0f, 0.903f, 0.009f, 1.0f};
+    const VkImageMemoryBarrier barrier = {
+        .sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .image            = image,
+        .oldLayout        = oldLayout,
+        .newLayout        = newLayout,
+        .subresourceRange = {.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .baseMipLevel   = 0,
+                             .levelCount     = 1,
+                             .baseArrayLayer = 0,
+                             .layerCount     = 1},
+        .srcAccessMask    = srcAccess,
+        .dstAccessMask    = dstAccess};
+
+    vkCmdPipelineBarrier(cmdBuf, srcStage, dstStage, 0, 0, NULL, 0, NULL, 1,
+                         &barrier);
+}
 
-        const VkRenderPassBeginInfo rpass = {
-            .sType           = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-            .clearValueCount = 1,
-            .pClearValues    = &clear,
-            .renderArea  = {{0, 0}, {engine->textureSize, engine->textureSize}},
-            .renderPass  = engine->singleCompositeRenderPass,
-            .framebuffer = engine->foregroundFrameBuffer,
-        };
+// copies between imageB and a slot of the layer pool. the source must be in
+// TRANSFER_SRC_OPTIMAL and the destination in TRANSFER_DST_OPTIMAL.
+static void
+cmdCopyLayerSlot(Engine* engine, const VkCommandBuffer cmdBuf,
+                 const uint16_t slot, const bool toSlot)
+{
+    const VkImageSubresourceLayers subRes = {
+        .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+        .mipLevel       = 0,
+        .baseArrayLayer = 0,
+        .layerCount     = 1};
+
+    const VkImageCopy region = {
+        .srcSubresource = subRes,
+        .dstSubresource = subRes,
+        .extent         = {engine->textureSize, engine->textureSize, 1}};
+
+    const VkImage imageB = engine->imageB.handle;
+    const VkImage image  = engine->layerPool.slots[slot].handle;
+    vkCmdCopyImage(cmdBuf, toSlot ? imageB : image,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   toSlot ? image : imageB,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+}
+
+static void
+touchSlot(Engine* engine, const uint16_t slot)
+{
+    engine->slotUse[slot] = ++engine->useClock;
+}
 
-        vkCmdBeginRenderPass(cmd.buffer, &rpass, VK_SUBPASS_CONTENTS_INLINE);
+// drops the device copy of a layer, once it no longer matches the layer
+static void
+evictLayer(Engine* engine, const Dali_LayerId id)
+{
+    const int16_t slot = engine->layerSlots[id];
+    if (slot < 0)
+        return;
+    engine->slotUse[slot]  = 0;
+    engine->layerSlots[id] = -1;
+}
 
-        // may not need this because same parameters as last bind?
-        vkCmdBindDescriptorSets(
-            cmd.buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, engine->pipelineLayout,
-            DESC_SET_COMP, 1,
-            &engine->description.descriptorSets[DESC_SET_COMP], 0, NULL);
+// the slots the pool may grow to: no more than the stack has layers, so a
+// small document only pays for the layers it has
+static uint16_t
+slotLimit(const Engine* engine, const Dali_LayerStack* stack)
+{
+    return MIN(dali_GetLayerCount(stack), engine->residentLimit);
+}
 
-        vkCmdBindPipeline(cmd.buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                          engine->compPipelines[PIPELINE_COMP_SINGLE]);
+// adds a free slot to the pool. it is left in SHADER_READ_ONLY_OPTIMAL, and
+// written to the composite's image array. the frames in flight do not index
+// the new element, which is what lets it be written under them.
+static uint16_t
+cmdAddSlot(Engine* engine, const VkCommandBuffer cmdBuf)
+{
+    const uint16_t slot = dali_AddLayerPoolSlot(&engine->layerPool);
+    assert(slot < engine->slotCapacity);
+    hell_DebugPrint(PAINT_DEBUG_TAG_PAINT, "%d resident layers\n", slot + 1);
+    cmdImageLayout(cmdBuf, engine->layerPool.slots[slot].handle,
+                   VK_IMAGE_LAYOUT_UNDEFINED,
+                   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    engine->slotUse[slot] = 0;
+    updateDescSetLayerImage(engine, slot);
+    return slot;
+}
 
-        vkCmdDraw(cmd.buffer, 3, 1, 0, 0);
+// returns the layer's slot. if it has none it is given a free one, then a new
+// one while the pool is below slotLimit, then the least recently used one that
+// is not kept. its contents are then up to the caller. returns -1 if every
+// slot is kept and the pool may not grow.
+static int
+acquireSlot(Engine* engine, const VkCommandBuffer cmdBuf,
+            const Dali_LayerStack* stack, const Dali_LayerId id,
+            const bool* kept)
+{
+    if (engine->layerSlots[id] >= 0)
+    {
+        touchSlot(engine, engine->layerSlots[id]);
+        return engine->layerSlots[id];
+    }
+    int victim = -1;
+    for (int s = 0; s < engine->layerPool.slotCount; s++)
+    {
+        if (kept && kept[s])
+            continue;
+        if (victim < 0 || engine->slotUse[s] < engine->slotUse[victim])
+            victim = s;
+    }
+    if ((victim < 0 || engine->slotUse[victim]) &&
+        engine->layerPool.slotCount < slotLimit(engine, stack))
+        victim = cmdAddSlot(engine, cmdBuf);
+    if (victim < 0)
+        return -1;
+    if (engine->slotUse[victim])
+        engine->layerSlots[engine->slotLayers[victim]] = -1;
+    engine->slotLayers[victim] = id;
+    engine->layerSlots[id]     = victim;
+    touchSlot(engine, victim);
+    return victim;
+}
 
-        vkCmdEndRenderPass(cmd.buffer);
+// frees the slots past slotLimit, after the stack has shrunk or the resident
+// layer count been lowered. the layers they held are uploaded from the stack
+// when next needed. no pending frame may read the slots freed, which holds
+// on a layer change since sync() has waited for the frames by then.
+static void
+trimLayerPool(Engine* engine, const Dali_LayerStack* stack)
+{
+    const uint16_t limit = slotLimit(engine, stack);
+    if (engine->layerPool.slotCount <= limit)
+        return;
+    for (uint16_t s = limit; s < engine->layerPool.slotCount; s++)
+    {
+        if (engine->slotUse[s])
+            evictLayer(engine, engine->slotLayers[s]);
     }
+    hell_DebugPrint(PAINT_DEBUG_TAG_PAINT, "%d resident layers\n", limit);
+    dali_TrimLayerPool(&engine->layerPool, limit);
+}
 
-    VkImageMemoryBarrier barrier1 = {
-        .sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .image            = engine->imageB.handle,
-        .oldLayout        = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-        .newLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        .subresourceRange = subResRange,
-        .srcAccessMask    = VK_ACCESS_TRANSFER_READ_BIT,
-        .dstAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT};
+// the flat images the budget has room for next to the slots the pool may
+// grow to
+static uint8_t
+flatLimit(const Engine* engine, const Dali_LayerStack* stack)
+{
+    return MIN(FLAT_IMAGE_COUNT,
+               engine->layerBudget - slotLimit(engine, stack));
+}
 
-    vkCmdPipelineBarrier(cmd.buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
-                         &barrier1);
-
-    BufferRegion* layerBuffer =
-        &dali_GetLayer(stack, engine->curLayerId)->bufferRegion;
-
-    obdn_CmdCopyBufferToImage(cmd.buffer, 0, layerBuffer, &engine->imageB);
-
-    VkImageMemoryBarrier barriers2[] = {
-        {.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-         .image            = engine->imageA.handle,
-         .oldLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-         .newLayout        = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-         .subresourceRange = subResRange,
-         .srcAccessMask    = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
-         .dstAccessMask    = 0},
-        {.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-         .image            = engine->imageB.handle,
-         .oldLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-         .newLayout        = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-         .subresourceRange = subResRange,
-         .srcAccessMask    = VK_ACCESS_MEMORY_READ_BIT,
-         .dstAccessMask    = 0},
-        {.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-         .image            = engine->imageC.handle,
-         .oldLayout        = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-         .newLayout        = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-         .subresourceRange = subResRange,
-         .srcAccessMask    = VK_ACCESS_MEMORY_WRITE_BIT,
-         .dstAccessMask    = 0},
-        {.sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-         .image            = engine->imageD.handle,
-         .oldLayout        = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-         .newLayout        = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-         .subresourceRange = subResRange,
-         .srcAccessMask    = VK_ACCESS_MEMORY_WRITE_BIT,
-         .dstAccessMask    = 0}};
-
-    vkCmdPipelineBarrier(cmd.buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0,
-                         NULL, LEN(barriers), barriers2);
-
-    obdn_EndCommandBuffer(cmd.buffer);
-
-    obdn_SubmitAndWait(&cmd, 0);
-
-    obdn_DestroyCommand(cmd);
+// creates the next flat image, in GENERAL layout, and writes it to the
+// composite's image arrays
+static uint8_t
+cmdAddFlatImage(Engine* engine, const VkCommandBuffer cmdBuf)
+{
+    const uint8_t flat  = engine->flatCount++;
+    Image*        image = &engine->flatImages[flat].image;
+    *image = obdn_CreateImageAndSampler(
+        engine->memory, engine->textureSize, engine->textureSize,
+        engine->textureFormat,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+        VK_IMAGE_ASPECT_COLOR_BIT, VK_SAMPLE_COUNT_1_BIT, 1, VK_FILTER_NEAREST,
+        OBDN_V_MEMORY_DEVICE_TYPE);
+    cmdImageLayout(cmdBuf, image->handle, VK_IMAGE_LAYOUT_UNDEFINED,
+                   VK_IMAGE_LAYOUT_GENERAL);
+    engine->flatImages[flat].use = 0;
+    updateDescSetFlatImage(engine, flat);
+    return flat;
+}
 
-    hell_DebugPrint(PAINT_DEBUG_TAG_PAINT, "End\n");
+// frees the flat images past flatLimit, after the stack has grown or the
+// resident layer count been raised. as with trimLayerPool, no pending frame
+// may read the images freed.
+static void
+trimFlatImages(Engine* engine, const Dali_LayerStack* stack)
+{
+    const uint8_t limit = flatLimit(engine, stack);
+    while (engine->flatCount > limit)
+    {
+        FlatImage* flat = &engine->flatImages[--engine->flatCount];
+        obdn_FreeImage(&flat->image);
+        flat->use        = 0;
+        flat->layerCount = 0;
+    }
 }
 
+// uploads a layer's host tiles into its slot. the slot is left in
+// SHADER_READ_ONLY_OPTIMAL.
 static void
-runUndoCommands(Engine* engine, const bool toHost, BufferRegion* bufferRegion)
-{
-    obdn_WaitForFence(engine->device, &engine->acquireImageCommand.fence);
-
-    obdn_ResetCommand(&engine->releaseImageCommand);
-    obdn_ResetCommand(&engine->transferImageCommand);
-    obdn_ResetCommand(&engine->acquireImageCommand);
-
-    VkCommandBuffer cmdBuf = engine->releaseImageCommand.buffer;
-
-    obdn_BeginCommandBuffer(cmdBuf);
-
-    const VkImageSubresourceRange range = {.aspectMask =
-                                               VK_IMAGE_ASPECT_COLOR_BIT,
-                                           .baseMipLevel   = 0,
-                                           .levelCount     = 1,
-                                           .baseArrayLayer = 0,
-                                           .layerCount     = 1};
-
-    const VkImageLayout otherLayout =
-        toHost ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
-               : VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    const VkAccessFlags otherAccessMask =
-        toHost ? VK_ACCESS_TRANSFER_READ_BIT : VK_ACCESS_TRANSFER_WRITE_BIT;
-
-    VkImageMemoryBarrier imgBarrier = {
-        .sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .pNext               = NULL,
-        .srcAccessMask       = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
-        .dstAccessMask       = otherAccessMask,
-        .oldLayout           = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        .newLayout           = otherLayout,
-        .srcQueueFamilyIndex = engine->graphicsQueueFamilyIndex,
-        .dstQueueFamilyIndex = engine->transferQueueFamilyIndex,
-        .image               = engine->imageB.handle,
-        .subresourceRange    = range};
+cmdRefreshLayerImage(Engine* engine, const VkCommandBuffer cmdBuf,
+                     Dali_LayerStack* stack, const Dali_LayerId id,
+                     const uint16_t slot)
+{
+    const VkImage image = engine->layerPool.slots[slot].handle;
+    cmdImageLayout(cmdBuf, image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    cmdUploadLayer(engine, cmdBuf, stack, id, image);
+    cmdImageLayout(cmdBuf, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    dali_GetLayer(stack, id)->written = false;
+}
 
-    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                         VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_DEPENDENCY_BY_REGION_BIT, 0, NULL, 0, NULL, 1,
-                         &imgBarrier);
+// stores the active layer and loads the new one into imageB. the old active
+// layer's copy is refreshed from imageB, and the new one is loaded from its
+// copy if it still has one, so switching between the few layers being worked
+// on stays on the device. the stack's host tiles are only read for a layer
+// that has been evicted or written on the host.
+static void
+onLayerChange(Engine* engine, Dali_LayerStack* stack, Dali_UndoManager* undo,
+              Dali_LayerId newLayerId)
+{
+    hell_DebugPrint(PAINT_DEBUG_TAG_PAINT, "Begin\n");
 
-    obdn_EndCommandBuffer(cmdBuf);
+    const Dali_LayerId prevLayerId = engine->curLayerId;
+    engine->compositeDirty = true;
 
-    cmdBuf = engine->transferImageCommand.buffer;
+    // a backup may still be draining into the stack tiles we are about to
+    // journal, and storedTiles may only hold the tiles of one layer
+    waitForDrain(engine);
+    finishTrim(engine, stack, true);
 
-    obdn_BeginCommandBuffer(cmdBuf);
+    // recorded after anything else sync() has recorded, so it sees imageB as
+    // they leave it
+    const VkCommandBuffer cmdBuf = beginSyncCommands(engine);
+    dali_CmdBeginStage(&engine->profiler, PROFILER_SLOT_SYNC, cmdBuf,
+                       DALI_STAGE_LAYER_CHANGE);
 
-    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                         VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_DEPENDENCY_BY_REGION_BIT, 0, NULL, 0, NULL, 1,
-                         &imgBarrier);
+    // collectAllDirtyTiles has waited for the frames, so none of them reads
+    // what the trims free
+    trimLayerPool(engine, stack);
+    trimFlatImages(engine, stack);
+
+    const VkImage imageB = engine->imageB.handle;
+    cmdImageLayout(cmdBuf, imageB, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+    // anything painted since the last backup becomes its own undo entry
+    if (journalDirtyTiles(engine, stack, undo, prevLayerId))
+    {
+        cmdTransferTiles(engine, cmdBuf, true, NULL);
+
+        // the stored tiles may be uploaded again later in this submission
+        const VkMemoryBarrier barrier = {
+            .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT |
+                             VK_ACCESS_HOST_READ_BIT};
+
+        vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT |
+                                 VK_PIPELINE_STAGE_HOST_BIT,
+                             0, 1, &barrier, 0, NULL, 0, NULL);
+    }
+
+    const uint16_t layerCount = dali_GetLayerCount(stack);
+    engine->curLayerId        = newLayerId;
+
+    // the copies of layers written on the host no longer match them
+    for (uint16_t l = 0; l < layerCount; l++)
+    {
+        if (dali_GetLayer(stack, l)->written)
+            evictLayer(engine, l);
+    }
 
-    if (toHost)
-        obdn_CmdCopyImageToBuffer(cmdBuf, 0, &engine->imageB, bufferRegion);
+    // imageB is the old layer as painted, unless its tiles were written on the
+    // host since it was loaded. the new layer's copy is about to be read, so
+    // it is not the one evicted to make room.
+    const bool prevWritten = dali_GetLayer(stack, prevLayerId)->written;
+    if (prevLayerId != newLayerId && !prevWritten)
+    {
+        bool kept[engine->slotCapacity];
+        memset(kept, 0, sizeof(kept));
+        if (engine->layerSlots[newLayerId] >= 0)
+            kept[engine->layerSlots[newLayerId]] = true;
+        const int slot = acquireSlot(engine, cmdBuf, stack, prevLayerId, kept);
+        if (slot >= 0)
+        {
+            const VkImage image = engine->layerPool.slots[slot].handle;
+            cmdImageLayout(cmdBuf, image,
+                           VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+            cmdCopyLayerSlot(engine, cmdBuf, slot, true);
+            cmdImageLayout(cmdBuf, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        }
+    }
+
+    // the layer stays in imageB if it is still the active one and nothing
+    // else has written it, otherwise it is loaded from its copy if it has one,
+    // and its tiles if not
+    Dali_Layer* newLayer = dali_GetLayer(stack, newLayerId);
+    if (prevLayerId != newLayerId || newLayer->written)
+    {
+        cmdImageLayout(cmdBuf, imageB, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        const int16_t slot = engine->layerSlots[newLayerId];
+        if (slot >= 0)
+        {
+            touchSlot(engine, slot);
+            const VkImage image = engine->layerPool.slots[slot].handle;
+            cmdImageLayout(cmdBuf, image,
+                           VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+            cmdCopyLayerSlot(engine, cmdBuf, slot, false);
+            cmdImageLayout(cmdBuf, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        }
+        else
+            cmdUploadLayer(engine, cmdBuf, stack, newLayerId, imageB);
+        // the copy is refreshed from imageB when the layer is left
+        cmdImageLayout(cmdBuf, imageB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
     else
-        obdn_CmdCopyBufferToImage(cmdBuf, 0, bufferRegion, &engine->imageB);
+        cmdImageLayout(cmdBuf, imageB, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-    imgBarrier.srcAccessMask       = otherAccessMask;
-    imgBarrier.dstAccessMask       = VK_ACCESS_SHADER_READ_BIT;
-    imgBarrier.oldLayout           = otherLayout;
-    imgBarrier.newLayout           = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    imgBarrier.srcQueueFamilyIndex = engine->transferQueueFamilyIndex;
-    imgBarrier.dstQueueFamilyIndex = engine->graphicsQueueFamilyIndex;
+    for (uint16_t l = 0; l < layerCount; l++)
+        dali_GetLayer(stack, l)->written = false;
 
-    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                         VK_DEPENDENCY_BY_REGION_BIT, 0, NULL, 0, NULL, 1,
-                         &imgBarrier);
+    dali_CmdEndStage(&engine->profiler, PROFILER_SLOT_SYNC, cmdBuf,
+                     DALI_STAGE_LAYER_CHANGE);
 
-    obdn_EndCommandBuffer(cmdBuf);
+    // the next sync submission carries these commands
+    engine->trimPending = true;
+    engine->trimLayer   = prevLayerId;
+    engine->trimValue   = engine->graphicsValue + 1;
+
+    hell_DebugPrint(PAINT_DEBUG_TAG_PAINT, "End\n");
+}
 
-    cmdBuf = engine->acquireImageCommand.buffer;
+// the transfers below leave imageB in SHADER_READ_ONLY_OPTIMAL
+static void
+cmdImageBBarrier(Engine* engine, const VkCommandBuffer cmdBuf,
+                 const bool toTransfer, const VkImageLayout transferLayout,
+                 const VkAccessFlags transferAccess)
+{
+    const VkImageMemoryBarrier barrier = {
+        .sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask    = toTransfer ? VK_ACCESS_INPUT_ATTACHMENT_READ_BIT |
+                                             VK_ACCESS_SHADER_READ_BIT
+                                       : transferAccess,
+        .dstAccessMask    = toTransfer ? transferAccess
+                                       : VK_ACCESS_SHADER_READ_BIT |
+                                          VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+        .oldLayout        = toTransfer ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                                       : transferLayout,
+        .newLayout        = toTransfer ? transferLayout
+                                       : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .image            = engine->imageB.handle,
+        .subresourceRange = {.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .baseMipLevel   = 0,
+                             .levelCount     = 1,
+                             .baseArrayLayer = 0,
+                             .layerCount     = 1}};
+
+    const VkPipelineStageFlags readStages =
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    vkCmdPipelineBarrier(cmdBuf,
+                         toTransfer ? readStages
+                                    : VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         toTransfer ? VK_PIPELINE_STAGE_TRANSFER_BIT
+                                    : readStages,
+                         VK_DEPENDENCY_BY_REGION_BIT, 0, NULL, 0, NULL, 1,
+                         &barrier);
+}
 
-    obdn_BeginCommandBuffer(cmdBuf);
+// uploads the queued tiles into imageB as part of the sync submission
+static void
+restoreTiles(Engine* engine)
+{
+    engine->compositeDirty = true;
+    const VkCommandBuffer cmdBuf = beginSyncCommands(engine);
+    dali_CmdBeginStage(&engine->profiler, PROFILER_SLOT_SYNC, cmdBuf,
+                       DALI_STAGE_RESTORE);
+    cmdImageBBarrier(engine, cmdBuf, true, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                     VK_ACCESS_TRANSFER_WRITE_BIT);
+    cmdTransferTiles(engine, cmdBuf, false, NULL);
+    cmdImageBBarrier(engine, cmdBuf, false,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                     VK_ACCESS_TRANSFER_WRITE_BIT);
+    dali_CmdEndStage(&engine->profiler, PROFILER_SLOT_SYNC, cmdBuf,
+                     DALI_STAGE_RESTORE);
+}
+
+// copies the queued tiles of imageB into the device staging buffer as part of
+// the sync submission, and records the drain of the staging buffer into the
+// queued host regions. the paint commands only wait on the first part. the
+// last drain must be done.
+static void
+captureTiles(Engine* engine)
+{
+    reserveStagingTiles(engine, engine->transferCount);
+
+    const VkCommandBuffer cmdBuf = beginSyncCommands(engine);
+    dali_CmdBeginStage(&engine->profiler, PROFILER_SLOT_SYNC, cmdBuf,
+                       DALI_STAGE_BACKUP);
+    cmdImageBBarrier(engine, cmdBuf, true, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                     VK_ACCESS_TRANSFER_READ_BIT);
+    cmdTransferTiles(engine, cmdBuf, true, &engine->stagingRegion);
+    cmdImageBBarrier(engine, cmdBuf, false,
+                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                     VK_ACCESS_TRANSFER_READ_BIT);
+
+    VkBufferMemoryBarrier bufBarrier = {
+        .sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask       = VK_ACCESS_TRANSFER_READ_BIT,
+        .srcQueueFamilyIndex = engine->graphicsQueueFamilyIndex,
+        .dstQueueFamilyIndex = engine->transferQueueFamilyIndex,
+        .buffer              = engine->stagingRegion.buffer,
+        .offset              = engine->stagingRegion.offset,
+        .size                = engine->stagingRegion.size};
 
     vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                         VK_DEPENDENCY_BY_REGION_BIT, 0, NULL, 0, NULL, 1,
-                         &imgBarrier);
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
+                         &bufBarrier, 0, NULL);
+
+    // the drain runs on the transfer queue, untimed
+    dali_CmdEndStage(&engine->profiler, PROFILER_SLOT_SYNC, cmdBuf,
+                     DALI_STAGE_BACKUP);
+
+    obdn_ResetCommand(&engine->drainCommand);
+    const VkCommandBuffer drainBuf = engine->drainCommand.buffer;
+    obdn_BeginCommandBuffer(drainBuf);
 
-    obdn_EndCommandBuffer(cmdBuf);
+    vkCmdPipelineBarrier(drainBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
+                         &bufBarrier, 0, NULL);
+
+    const VkDeviceSize tileSize =
+        DALI_TILE_SIZE * DALI_TILE_SIZE * DALI_TEXEL_SIZE;
+    for (uint32_t i = 0; i < engine->transferCount; i++)
+    {
+        const BufferRegion* tile   = engine->transferRegions[i];
+        const VkBufferCopy  region = {
+            .srcOffset = engine->stagingRegion.offset + i * tileSize,
+            .dstOffset = tile->offset,
+            .size      = tileSize};
+        vkCmdCopyBuffer(drainBuf, engine->stagingRegion.buffer, tile->buffer,
+                        1, &region);
+    }
 
-    obdn_SubmitGraphicsCommand(
-        engine->instance, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, NULL, 1,
-        &engine->releaseImageCommand.semaphore, VK_NULL_HANDLE,
-        engine->releaseImageCommand.buffer);
+    const VkMemoryBarrier hostBarrier = {
+        .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT};
 
-    obdn_SubmitTransferCommand(engine->instance, 0,
-                               VK_PIPELINE_STAGE_TRANSFER_BIT,
-                               &engine->releaseImageCommand.semaphore,
-                               VK_NULL_HANDLE, &engine->transferImageCommand);
+    vkCmdPipelineBarrier(drainBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0,
+                         NULL, 0, NULL);
 
-    obdn_SubmitGraphicsCommand(
-        engine->instance, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 1,
-        &engine->transferImageCommand.semaphore, 1,
-        &engine->acquireImageCommand.semaphore,
-        engine->acquireImageCommand.fence, engine->acquireImageCommand.buffer);
+    obdn_EndCommandBuffer(drainBuf);
+    engine->syncCaptured = true;
 }
 
-static void
-backupLayer(Engine* engine, Dali_UndoManager* undo)
+static bool
+backupLayer(Engine* engine, Dali_LayerStack* stack, Dali_UndoManager* undo)
 {
-    runUndoCommands(engine, true, dali_GetNextUndoBuffer(undo));
+    // the staging buffer and drain command are free once the last drain is
+    // done, which it almost always is by the next stroke
+    waitForDrain(engine);
+    if (!journalDirtyTiles(engine, stack, undo, engine->curLayerId))
+        return false; // nothing painted since the last backup
+    captureTiles(engine);
     hell_DebugPrint(DTAG, "layer backed up\n");
+    return true;
 }
 
+// swaps the entry's tiles with the stack's, so the entry ends up holding what
+// it replaced. returns true if imageB needs the queued tiles uploaded.
 static bool
-undo(Engine* engine, Dali_UndoManager* undo)
+swapEntryTiles(Engine* engine, Dali_LayerStack* stack, Dali_UndoManager* undo,
+               Dali_UndoEntry* entry)
+{
+    const Dali_LayerId id = engine->curLayerId;
+    engine->transferCount = 0;
+    for (uint32_t i = 0; i < entry->tileCount; i++)
+    {
+        const uint32_t     t   = entry->tiles[i].index;
+        const BufferRegion cur = dali_DetachLayerTile(stack, entry->layer, t);
+        dali_AttachLayerTile(stack, entry->layer, t, &entry->tiles[i].region);
+        entry->tiles[i].region = cur;
+        if (entry->layer != id)
+            continue;
+        engine->transferTiles[engine->transferCount]   = t;
+        engine->transferRegions[engine->transferCount] =
+            dali_GetLayerTile(stack, id, t);
+        engine->transferCount++;
+        engine->storedTiles[t] = true;
+    }
+    dali_GetLayer(stack, entry->layer)->version++;
+    if (entry->layer != id)
+    {
+        // the stroke was on another layer, so its device copy no longer
+        // matches it
+        evictLayer(engine, entry->layer);
+        onLayerChange(engine, stack, undo, id);
+        return false;
+    }
+    return true;
+}
+
+// reverts anything painted since the last backup, or failing that, the last
+// recorded stroke
+static bool
+undo(Engine* engine, Dali_LayerStack* stack, Dali_UndoManager* undo)
 {
     hell_DebugPrint(DTAG, "undo\n");
-    BufferRegion* buf = dali_GetLastUndoBuffer(undo);
-    if (!buf)
-        return false; // nothing to undo
-    runUndoCommands(engine, false, buf);
+    const Dali_LayerId id = engine->curLayerId;
+    waitForDrain(engine);
+    engine->transferCount = 0;
+    for (uint32_t t = 0; t < engine->tileCount; t++)
+    {
+        if (!engine->dirtyTiles[t])
+            continue;
+        engine->transferTiles[engine->transferCount]   = t;
+        engine->transferRegions[engine->transferCount] =
+            dali_GetLayerTile(stack, id, t);
+        engine->transferCount++;
+        engine->dirtyTiles[t] = false;
+    }
+    if (engine->transferCount == 0)
+    {
+        Dali_UndoEntry entry;
+        if (!dali_PopUndoEntry(undo, &entry))
+            return false; // nothing to undo
+        const bool upload = swapEntryTiles(engine, stack, undo, &entry);
+        dali_PushRedoEntry(undo, &entry);
+        if (!upload)
+            return false;
+    }
+    restoreTiles(engine);
+    return true;
+}
+
+static bool
+redo(Engine* engine, Dali_LayerStack* stack, Dali_UndoManager* undo)
+{
+    hell_DebugPrint(DTAG, "redo\n");
+    waitForDrain(engine);
+    Dali_UndoEntry entry;
+    if (!dali_PopRedoEntry(undo, &entry))
+        return false; // nothing to redo
+    const bool upload = swapEntryTiles(engine, stack, undo, &entry);
+    dali_PushUndoEntry(undo, &entry);
+    if (!upload)
+        return false;
+    restoreTiles(engine);
     return true;
 }
 
 static void
 updateView(Engine* engine, const Obdn_Scene* scene)
 {
-    UboMatrices* matrices = (UboMatrices*)engine->matrixRegion.hostData;
+    UboMatrices* matrices = &engine->uboMatrices;
     matrices->view        = obdn_GetCameraView(scene);
     matrices->viewInv     = coal_Invert4x4(matrices->view);
 }
@@ -1269,7 +2025,7 @@ updateView(Engine* engine, const Obdn_Scene* scene)
 static void
 updateProj(Engine* engine, const Obdn_Scene* scene)
 {
-    UboMatrices* matrices = (UboMatrices*)engine->matrixRegion.hostData;
+    UboMatrices* matrices = &engine->uboMatrices;
     matrices->proj        = obdn_GetCameraProjection(scene);
     matrices->projInv     = coal_Invert4x4(matrices->proj);
 }
@@ -1277,81 +2033,250 @@ updateProj(Engine* engine, const Obdn_Scene* scene)
 static void
 updateBrushColor(Engine* engine, float r, float g, float b)
 {
-    UboBrush* brush = (UboBrush*)engine->brushRegion.hostData;
+    UboBrush* brush = &engine->uboBrush;
     brush->r        = r;
     brush->g        = g;
     brush->b        = b;
 }
 
-static void
-updateBrush(Engine* engine, const Dali_Brush* b)
-{
-    UboBrush* brush = (UboBrush*)engine->brushRegion.hostData;
-    if (b->mode != PAINT_MODE_ERASE)
-        updateBrushColor(engine, b->r, b->g, b->b);
+// only called when the brush has changed
+static void
+updateBrush(Engine* engine, const Dali_Brush* b)
+{
+    UboBrush* brush = &engine->uboBrush;
+    if (b->mode != PAINT_MODE_ERASE)
+        updateBrushColor(engine, b->r, b->g, b->b);
+    else
+        updateBrushColor(engine, 1, 1, 1); // must be white for erase to work
+
+    engine->brushActive = b->active;
+
+    engine->prevBrushPos.x = engine->brushPos.x;
+    engine->prevBrushPos.y = engine->brushPos.y;
+    engine->brushPos.x     = b->x;
+    engine->brushPos.y     = b->y;
+
+    engine->brushRadius  = b->radius;
+    engine->brushQuality = b->quality;
+
+    brush->radius       = b->radius;
+    brush->x            = b->x;
+    brush->y            = b->y;
+    brush->opacity      = b->opacity;
+    brush->anti_falloff = (1.0 - b->falloff) * b->radius;
+}
+
+static VkDeviceAddress
+bufferAddress(const Engine* engine, const VkBuffer buffer)
+{
+    const VkBufferDeviceAddressInfo info = {
+        .sType  = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .buffer = buffer};
+    return vkGetBufferDeviceAddress(engine->device, &info);
+}
+
+static void
+destroyPrimStructures(Engine* engine)
+{
+    for (uint32_t i = 0; i < engine->blasCount; i++)
+        obdn_DestroyAccelerationStruct(engine->device, &engine->blasses[i]);
+    free(engine->blasses);
+    free(engine->blasTopologies);
+    engine->blasses        = NULL;
+    engine->blasTopologies = NULL;
+    engine->blasCount      = 0;
+    engine->blasRefits     = 0;
+    if (engine->topLevelAS.bufferRegion.size)
+        obdn_DestroyAccelerationStruct(engine->device, &engine->topLevelAS);
+    if (engine->primTableRegion.size)
+        obdn_FreeBufferRegion(&engine->primTableRegion);
+}
+
+// whether the scene's prims only moved their vertices since the blasses were
+// built. a prim whose vertex and index counts are unchanged is taken to keep
+// its indices, which is what a deforming cook sends.
+static bool
+canRefitBlasses(const Engine* engine, const Obdn_Scene* scene)
+{
+    if (engine->blasCount != obdn_GetPrimCount(scene) ||
+        engine->blasRefits >= MAX_BLAS_REFITS)
+        return false;
+    for (uint32_t i = 0; i < engine->blasCount; i++)
+    {
+        const Obdn_Geometry* geo = &obdn_GetPrimitive(scene, i)->geo;
+        if (geo->vertexCount != engine->blasTopologies[i].vertexCount ||
+            geo->indexCount != engine->blasTopologies[i].indexCount)
+            return false;
+    }
+    return true;
+}
+
+// every primitive in the scene becomes an instance of the tlas, placed by its
+// own transform. the hit shader reads the instance's uvs and indices through
+// the addresses at its gl_InstanceID in the prim table. deformed prims have
+// their blasses refit in place rather than rebuilt.
+static void
+updatePrim(Engine* engine, const Obdn_Scene* scene)
+{
+    const uint32_t primCount = obdn_GetPrimCount(scene);
+    if (primCount == 0)
+    {
+        hell_DPrint("No prims in the scene to paint on\n");
+        return;
+    }
+
+    // the builds block, so they are timed on the host from here
+    struct timespec start;
+    timespec_get(&start, TIME_UTC);
+
+    // frames in flight may still be tracing against the old structures
+    waitForFrames(engine);
+
+    const Obdn_Geometry* geos[primCount];
+    for (uint32_t i = 0; i < primCount; i++)
+    {
+        geos[i] = &obdn_GetPrimitive(scene, i)->geo;
+        assert(geos[i]->vertexRegion.size);
+    }
+
+    if (canRefitBlasses(engine, scene))
+    {
+        dali_RefitBlasses(engine->instance, engine->memory, primCount, geos,
+                          engine->blasses);
+        engine->blasRefits++;
+        obdn_DestroyAccelerationStruct(engine->device, &engine->topLevelAS);
+        obdn_FreeBufferRegion(&engine->primTableRegion);
+    }
     else
-        updateBrushColor(engine, 1, 1, 1); // must be white for erase to work
+    {
+        destroyPrimStructures(engine);
+        engine->blasCount = primCount;
+        engine->blasses =
+            calloc(primCount, sizeof(Obdn_R_AccelerationStructure));
+        engine->blasTopologies = calloc(primCount, sizeof(PrimTopology));
+        for (uint32_t i = 0; i < primCount; i++)
+        {
+            engine->blasTopologies[i].vertexCount = geos[i]->vertexCount;
+            engine->blasTopologies[i].indexCount  = geos[i]->indexCount;
+        }
+        dali_BuildBlasses(engine->instance, engine->memory, primCount, geos,
+                          engine->blasses);
+    }
 
-    engine->brushActive = b->active;
+    // the tlas only has an instance per prim, so it is always rebuilt. the
+    // prims may have moved to new buffers as well.
+    engine->primTableRegion = obdn_RequestBufferRegion(
+        engine->memory, primCount * sizeof(PrimAddresses),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
+    PrimAddresses* table = (PrimAddresses*)engine->primTableRegion.hostData;
+    Coal_Mat4*     xforms = malloc(primCount * sizeof(Coal_Mat4));
 
-    engine->prevBrushPos.x = engine->brushPos.x;
-    engine->prevBrushPos.y = engine->brushPos.y;
-    engine->brushPos.x     = b->x;
-    engine->brushPos.y     = b->y;
+    for (uint32_t i = 0; i < primCount; i++)
+    {
+        const Obdn_Primitive* prim = obdn_GetPrimitive(scene, i);
+        xforms[i]                  = prim->xform;
+
+        table[i].uvs = bufferAddress(engine, prim->geo.vertexRegion.buffer) +
+                       obdn_GetAttrOffset(&prim->geo, "uv");
+        table[i].indices =
+            bufferAddress(engine, prim->geo.indexRegion.buffer) +
+            prim->geo.indexRegion.offset;
+    }
 
-    brush->radius       = b->radius;
-    brush->x            = b->x;
-    brush->y            = b->y;
-    brush->opacity      = b->opacity;
-    brush->anti_falloff = (1.0 - b->falloff) * b->radius;
+    obdn_BuildTlas(engine->memory, primCount, engine->blasses, xforms,
+                   &engine->topLevelAS);
+    free(xforms);
+
+    updateDescSetPrim(engine);
+
+    struct timespec end;
+    timespec_get(&end, TIME_UTC);
+    dali_AddStageSample(&engine->profiler, DALI_STAGE_PRIM,
+                        (end.tv_sec - start.tv_sec) * 1000.0 +
+                            (end.tv_nsec - start.tv_nsec) / 1000000.0);
 }
 
+// measures how many texels the frame's dabs spanned. the paint commands that
+// traced them must have completed.
 static void
-updatePaintMode(Engine* engine, const Dali_Brush* b)
+collectDabBounds(Engine* engine, Frame* frame)
 {
-    vkDeviceWaitIdle(engine->device);
-    destroyCompPipelines(engine);
-    switch (b->mode)
+    const int32_t* bounds = (const int32_t*)frame->dabBoundsRegion.hostData;
+    int32_t        extent = 0;
+    for (uint32_t i = 1; i <= frame->dabCount; i++)
     {
-    case PAINT_MODE_OVER:
-        initCompPipelines(engine, OBDN_R_BLEND_MODE_OVER);
-        break;
-    case PAINT_MODE_ERASE:
-        initCompPipelines(engine, OBDN_R_BLEND_MODE_ERASE);
-        break;
+        const int32_t* b = bounds + 4 * i;
+        if (b[2] < b[0])
+            continue; // missed the mesh entirely
+        extent = MAX(extent, MAX(b[2] - b[0], b[3] - b[1]) + 1);
     }
+    if (extent > 0 && frame->dabRadius > 0)
+        engine->texelsPerRadius = extent / frame->dabRadius;
+    frame->dabCount = 0;
 }
 
 static void
-updatePrim(Engine* engine, const Obdn_Scene* scene)
+resetDabBounds(Frame* frame, const uint32_t dabCount, const float radius)
 {
-    Obdn_Primitive* prim = obdn_GetPrimitive(scene, engine->activePrim.id);
-    assert(prim->geo.vertexRegion.size);
-    if (engine->bottomLevelAS.bufferRegion.size)
-        obdn_DestroyAccelerationStruct(engine->device, &engine->bottomLevelAS);
-    if (engine->topLevelAS.bufferRegion.size)
-        obdn_DestroyAccelerationStruct(engine->device, &engine->topLevelAS);
+    int32_t* bounds = (int32_t*)frame->dabBoundsRegion.hostData;
+    for (uint32_t i = 0; i <= dabCount; i++)
+    {
+        bounds[4 * i + 0] = INT32_MAX;
+        bounds[4 * i + 1] = INT32_MAX;
+        bounds[4 * i + 2] = -1;
+        bounds[4 * i + 3] = -1;
+    }
+    frame->dabCount  = dabCount;
+    frame->dabRadius = radius;
+}
 
-    Coal_Mat4 xform = COAL_MAT4_IDENT;
-    obdn_BuildBlas(engine->memory, &prim->geo, &engine->bottomLevelAS);
-    obdn_BuildTlas(engine->memory, 1, &engine->bottomLevelAS, &xform,
-                   &engine->topLevelAS);
+// one ray per texel of the dab's footprint, scaled by the brush quality. until
+// a dab has been measured we fall back to the full launch.
+static uint32_t
+dabLaunchSize(const Engine* engine)
+{
+    if (engine->texelsPerRadius <= 0)
+        return MAX_DAB_LAUNCH;
+    const float size =
+        engine->brushQuality * engine->texelsPerRadius * engine->brushRadius;
+    if (size >= MAX_DAB_LAUNCH)
+        return MAX_DAB_LAUNCH;
+    return MAX((uint32_t)size, MIN_DAB_LAUNCH);
+}
 
-    updateDescSetPrim(engine, scene);
+// xorshift64*, returns a float in [0, 1)
+static float
+engineRand(Engine* engine)
+{
+    uint64_t x = engine->rngState;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    engine->rngState = x;
+    return ((x * 0x2545f4914f6cdd1d) >> 40) / (float)(1 << 24);
 }
 
+// traces every dab queued in dabRegion in one launch, one dab per layer of
+// the launch depth and launchSize rays along each side of a dab
 static void
-splat(Engine* engine, const VkCommandBuffer cmdBuf, const float x,
-      const float y)
+splat(Engine* engine, const Frame* frame, const VkCommandBuffer cmdBuf,
+      const uint32_t dabCount, const uint32_t launchSize)
 {
+    dali_CmdBeginStage(&engine->profiler, engine->frameIndex, cmdBuf,
+                       DALI_STAGE_SPLAT);
+
     vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
                       engine->paintPipeline);
 
+    const VkDescriptorSet sets[] = {
+        engine->description.descriptorSets[DESC_SET_PRIM],
+        frame->descriptorSet};
+
     vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
-                            engine->pipelineLayout, 0, 2,
-                            engine->description.descriptorSets, 0, NULL);
+                            engine->pipelineLayout, DESC_SET_PRIM, LEN(sets),
+                            sets, 0, NULL);
 
-    float pc[4] = {coal_Rand(), coal_Rand(), x, y};
+    float pc[2] = {engineRand(engine), engineRand(engine)};
 
     vkCmdPushConstants(cmdBuf, engine->pipelineLayout,
                        VK_SHADER_STAGE_RAYGEN_BIT_KHR, 0, sizeof(pc), pc);
@@ -1359,14 +2284,24 @@ splat(Engine* engine, const VkCommandBuffer cmdBuf, const float x,
     vkCmdTraceRaysKHR(cmdBuf, &engine->shaderBindingTable.raygenTable,
                       &engine->shaderBindingTable.missTable,
                       &engine->shaderBindingTable.hitTable,
-                      &engine->shaderBindingTable.callableTable, 2000, 2000, 1);
+                      &engine->shaderBindingTable.callableTable, launchSize,
+                      launchSize, dabCount);
+
+    dali_CmdEndStage(&engine->profiler, engine->frameIndex, cmdBuf,
+                     DALI_STAGE_SPLAT);
 }
 
+// blends the stamp onto the layer and clears it again. the render area has
+// to be given up front while the bounds are only known on the device, so it
+// is dab.vert that limits both draws to the texels the dabs wrote.
 static void
-applyPaint(Engine* engine, const VkCommandBuffer cmdBuf)
+applyPaint(Engine* engine, const Frame* frame, const VkCommandBuffer cmdBuf)
 {
     VkClearValue clear = {0, 0, 0, 0};
 
+    dali_CmdBeginStage(&engine->profiler, engine->frameIndex, cmdBuf,
+                       DALI_STAGE_APPLY);
+
     const VkRenderPassBeginInfo rpass = {
         .sType           = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
         .clearValueCount = 1,
@@ -1377,173 +2312,498 @@ applyPaint(Engine* engine, const VkCommandBuffer cmdBuf)
 
     vkCmdBeginRenderPass(cmdBuf, &rpass, VK_SUBPASS_CONTENTS_INLINE);
 
+    const VkDescriptorSet sets[] = {
+        frame->descriptorSet,
+        engine->description.descriptorSets[DESC_SET_COMP]};
+
     vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            engine->pipelineLayout, DESC_SET_COMP, 1,
-                            &engine->description.descriptorSets[DESC_SET_COMP],
-                            0, NULL);
+                            engine->pipelineLayout, DESC_SET_PAINT, LEN(sets),
+                            sets, 0, NULL);
 
     vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      engine->compPipelines[PIPELINE_COMP_1]);
+                      applyPipeline(engine));
 
-    vkCmdDraw(cmdBuf, 3, 1, 0, 0);
+    vkCmdDraw(cmdBuf, 6, 1, 0, 0);
 
-    vkCmdEndRenderPass(cmdBuf);
-}
+    dali_CmdEndStage(&engine->profiler, engine->frameIndex, cmdBuf,
+                     DALI_STAGE_APPLY);
 
-static void
-comp(Engine* engine, const VkCommandBuffer cmdBuf)
-{
-    VkClearValue clear = {0, 0, 0, 0};
+    vkCmdNextSubpass(cmdBuf, VK_SUBPASS_CONTENTS_INLINE);
 
-    VkClearValue clears[] = {clear, clear, clear, clear};
+    dali_CmdBeginStage(&engine->profiler, engine->frameIndex, cmdBuf,
+                       DALI_STAGE_CLEAR_STAMP);
 
-    const VkRenderPassBeginInfo rpass = {
-        .sType           = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-        .clearValueCount = LEN(clears),
-        .pClearValues    = clears,
-        .renderArea      = {{0, 0}, {engine->textureSize, engine->textureSize}},
-        .renderPass      = engine->compositeRenderPass,
-        .framebuffer     = engine->compositeFrameBuffer};
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      engine->compPipelines[PIPELINE_CLEAR_STAMP]);
 
-    vkCmdBeginRenderPass(cmdBuf, &rpass, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdDraw(cmdBuf, 6, 1, 0, 0);
 
-    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      engine->compPipelines[PIPELINE_COMP_2]);
+    vkCmdEndRenderPass(cmdBuf);
+
+    dali_CmdEndStage(&engine->profiler, engine->frameIndex, cmdBuf,
+                     DALI_STAGE_CLEAR_STAMP);
+}
 
-    vkCmdDraw(cmdBuf, 3, 1, 0, 0);
+// lists the visible layers bottom first. which image each one is read from is
+// only settled when the composite is recorded.
+static void
+updateLayerTable(Engine* engine, Dali_LayerStack* stack)
+{
+    CompLayerTable* table = engine->layerTable;
+    table->count          = 0;
+    engine->compBelow     = 0;
+    engine->compAbove     = 0;
+    bool activeFound      = false;
+    for (uint16_t i = 0; i < dali_GetLayerCount(stack); i++)
+    {
+        const Dali_LayerId id    = stack->order[i];
+        const Dali_Layer*  layer = dali_GetLayer(stack, id);
+        activeFound |= id == engine->curLayerId;
+        if (!layer->visible || layer->opacity == 0)
+            continue;
+        engine->compLayers[table->count] = id;
+        CompLayer* comp = &table->layers[table->count++];
+        comp->opacity   = layer->opacity;
+        comp->blendMode = layer->blendMode;
+        comp->flags     = 0;
+        comp->occupancy = OCC_ROW_LAYERS + id;
+        if (!activeFound)
+            engine->compBelow = table->count;
+        if (!activeFound || id == engine->curLayerId)
+            engine->compAbove = table->count;
+    }
+    engine->compositeDirty = true;
+}
 
-    vkCmdNextSubpass(cmdBuf, VK_SUBPASS_CONTENTS_INLINE);
+// gives the table entries from first on an image to be read from, uploading
+// the layers that are not resident, until every slot is in use by the batch.
+// returns the number of entries the batch covers.
+static uint32_t
+cmdLoadCompBatch(Engine* engine, const VkCommandBuffer cmdBuf,
+                 Dali_LayerStack* stack, const uint32_t first,
+                 const uint32_t last)
+{
+    CompLayerTable* table = engine->layerTable;
+    bool            kept[engine->slotCapacity];
+    uint32_t        i;
+    memset(kept, 0, sizeof(kept));
+    for (i = first; i < last; i++)
+    {
+        const Dali_LayerId id = engine->compLayers[i];
+        if (id == COMP_LAYER_FIXED)
+            continue;
+        if (id == engine->curLayerId)
+        {
+            table->layers[i].image = COMP_IMAGE_ACTIVE;
+            continue;
+        }
+        const bool resident = engine->layerSlots[id] >= 0;
+        const int  slot     = acquireSlot(engine, cmdBuf, stack, id, kept);
+        if (slot < 0)
+            break;
+        if (!resident)
+        {
+            // the tiles of the layer last left may still be trimmed
+            if (engine->trimPending && engine->trimLayer == id)
+                finishTrim(engine, stack, true);
+            cmdRefreshLayerImage(engine, cmdBuf, stack, id, slot);
+        }
+        kept[slot]             = true;
+        table->layers[i].image = COMP_IMAGE_SLOTS + slot;
+    }
+    return i - first;
+}
 
-    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      engine->compPipelines[PIPELINE_COMP_3]);
+// orders the composite's accesses to the images it writes and reads
+static void
+cmdCompositeBarrier(const VkCommandBuffer cmdBuf)
+{
+    const VkMemoryBarrier barrier = {
+        .sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT};
+
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, NULL, 0, NULL);
+}
 
-    vkCmdDraw(cmdBuf, 3, 1, 0, 0);
+// blends the table entries from first to last into target. that takes one
+// dispatch while the layers fit in the layer array. otherwise they are
+// blended in batches, each uploading the layers it lacks over the slots the
+// last one read, and blending onto what the last one wrote.
+static void
+cmdCompositeRange(Engine* engine, const Frame* frame, const VkCommandBuffer cmdBuf,
+                  Dali_LayerStack* stack, const uint32_t first,
+                  const uint32_t last, const uint32_t target)
+{
+    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      engine->compositePipeline);
+
+    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            engine->pipelineLayout, DESC_SET_PAINT, 1,
+                            &frame->descriptorSet, 0, NULL);
+
+    vkCmdBindDescriptorSets(
+        cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, engine->pipelineLayout,
+        DESC_SET_LAYERS, 1, &engine->description.descriptorSets[DESC_SET_LAYERS],
+        0, NULL);
+
+    const uint32_t groups =
+        (engine->textureSize + COMP_GROUP_SIZE - 1) / COMP_GROUP_SIZE;
+    CompBatch batch = {.first = first, .target = target};
+    do
+    {
+        batch.count = cmdLoadCompBatch(engine, cmdBuf, stack, batch.first, last);
+        assert(batch.count > 0 || first == last);
 
-    vkCmdNextSubpass(cmdBuf, VK_SUBPASS_CONTENTS_INLINE);
+        if (batch.accumulate)
+            cmdCompositeBarrier(cmdBuf);
 
-    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      engine->compPipelines[PIPELINE_COMP_4]);
+        vkCmdPushConstants(cmdBuf, engine->pipelineLayout,
+                           VK_SHADER_STAGE_COMPUTE_BIT, COMP_BATCH_OFFSET,
+                           sizeof(batch), &batch);
 
-    vkCmdDraw(cmdBuf, 3, 1, 0, 0);
+        vkCmdDispatch(cmdBuf, groups, groups, 1);
 
-    vkCmdEndRenderPass(cmdBuf);
+        batch.first += batch.count;
+        batch.accumulate = true;
+    } while (batch.count > 0 && batch.first < last);
 }
 
-static VkSemaphore
-sync(Engine* engine, const Obdn_Scene* scene, Dali_LayerStack* stack,
-     const Dali_Brush* brush, Dali_UndoManager* u)
+// a tile of a flat image shows nothing if none of its layers do, and hides
+// what is below it if one of them does at full opacity, whatever its blend
+// mode, since the modes only change color
+static void
+flattenOccupancy(Engine* engine, Dali_LayerStack* stack, const uint32_t first,
+                 const uint32_t last, uint8_t* occupancy)
 {
-    VkSemaphore                semaphore = VK_NULL_HANDLE;
-    const Obdn_SceneDirtyFlags sceneDirt = obdn_GetSceneDirt(scene);
-    if (brush->dirt || sceneDirt || stack->dirt || u->dirt)
+    const CompLayerTable* table = engine->layerTable;
+    for (uint32_t t = 0; t < engine->tileCount; t++)
     {
-        if (sceneDirt & OBDN_SCENE_CAMERA_VIEW_BIT)
-            updateView(engine, scene);
-        if (sceneDirt & OBDN_SCENE_CAMERA_PROJ_BIT)
-            updateProj(engine, scene);
-        if (brush->dirt & BRUSH_BIT)
-            updateBrush(engine, brush);
-        if (sceneDirt & OBDN_SCENE_PRIMS_BIT)
-            updatePrim(engine, scene);
-        if (u->dirt & UNDO_BIT)
-        {
-            if (undo(engine, u))
-                semaphore = engine->acquireImageCommand.semaphore;
-        }
-        if (stack->dirt & LAYER_CHANGED_BIT)
+        Dali_TileOccupancy occ = DALI_TILE_EMPTY;
+        for (uint32_t i = first; i < last && occ != DALI_TILE_OPAQUE; i++)
         {
-            onLayerChange(engine, stack,
-                          stack->activeLayer); // only one that needs the stack
+            const Dali_TileOccupancy layerOcc =
+                dali_GetLayerTileOccupancy(stack, engine->compLayers[i], t);
+            if (layerOcc == DALI_TILE_OPAQUE && table->layers[i].opacity == 1)
+                occ = DALI_TILE_OPAQUE;
+            else if (layerOcc != DALI_TILE_EMPTY)
+                occ = DALI_TILE_PARTIAL;
         }
-        if (stack->dirt & LAYER_BACKUP_BIT)
+        occupancy[t] = occ;
+    }
+}
+
+// returns the flat image of the table entries from first to last. if none
+// holds them as they are now they are blended into a free one, then a new one
+// while there are fewer than flatLimit, then the least recently used one that
+// is not kept. returns -1 if there is none to blend them into, and the
+// composite then blends the layers themselves.
+static int
+cmdFlatten(Engine* engine, const Frame* frame, const VkCommandBuffer cmdBuf,
+           Dali_LayerStack* stack, const uint32_t first, const uint32_t last,
+           bool* kept)
+{
+    const CompLayerTable* table      = engine->layerTable;
+    const uint32_t        layerCount = last - first;
+    FlatLayer             layers[layerCount];
+    for (uint32_t i = 0; i < layerCount; i++)
+    {
+        const Dali_LayerId id = engine->compLayers[first + i];
+        layers[i] = (FlatLayer){.id        = id,
+                                .version   = dali_GetLayer(stack, id)->version,
+                                .opacity   = table->layers[first + i].opacity,
+                                .blendMode = table->layers[first + i].blendMode};
+    }
+
+    int flat = -1;
+    for (int i = 0; i < engine->flatCount; i++)
+    {
+        const FlatImage* image = &engine->flatImages[i];
+        if (image->use && image->layerCount == layerCount &&
+            memcmp(image->layers, layers, layerCount * sizeof(FlatLayer)) == 0)
         {
-            backupLayer(engine, u);
-            semaphore = engine->acquireImageCommand.semaphore;
+            flat = i;
+            break;
         }
-        if (brush->dirt & PAINT_MODE_BIT)
+    }
+
+    if (flat < 0)
+    {
+        for (int i = 0; i < engine->flatCount; i++)
         {
-            updatePaintMode(engine, brush);
+            if (kept[i])
+                continue;
+            if (flat < 0 ||
+                engine->flatImages[i].use < engine->flatImages[flat].use)
+                flat = i;
         }
+        if ((flat < 0 || engine->flatImages[flat].use) &&
+            engine->flatCount < flatLimit(engine, stack))
+            flat = cmdAddFlatImage(engine, cmdBuf);
+        if (flat < 0)
+            return -1;
+        FlatImage* image  = &engine->flatImages[flat];
+        image->layerCount = layerCount;
+        image->layers = realloc(image->layers, layerCount * sizeof(FlatLayer));
+        assert(image->layers);
+        memcpy(image->layers, layers, layerCount * sizeof(FlatLayer));
+        flattenOccupancy(engine, stack, first, last, image->occupancy);
+
+        // an earlier composite may still be reading it
+        cmdCompositeBarrier(cmdBuf);
+        cmdCompositeRange(engine, frame, cmdBuf, stack, first, last,
+                          COMP_TARGET_FLAT + flat);
+        cmdCompositeBarrier(cmdBuf);
     }
-    return semaphore;
+
+    engine->flatImages[flat].use = ++engine->flatClock;
+    kept[flat]                   = true;
+    return flat;
 }
 
+// fills an occupancy row of the frame's composite. the active layer is being
+// painted, so nothing is known about its tiles.
 static void
-updateCommands(Engine* engine, VkCommandBuffer cmdBuf)
+packOccupancy(Engine* engine, const Frame* frame, const uint32_t row,
+              const uint8_t* occupancy)
 {
-    VkClearColorValue clearColor = {
-        .float32[0] = 0,
-        .float32[1] = 0,
-        .float32[2] = 0,
-        .float32[3] = 0,
-    };
+    uint32_t* words = (uint32_t*)frame->occupancyRegion.hostData +
+                      row * engine->occupancyRowSize;
+    memset(words, 0, engine->occupancyRowSize * sizeof(uint32_t));
+    for (uint32_t t = 0; t < engine->tileCount; t++)
+    {
+        const uint32_t occ = occupancy ? occupancy[t] : DALI_TILE_PARTIAL;
+        words[t / OCC_PER_WORD] |= occ << (t % OCC_PER_WORD * OCC_BITS);
+    }
+}
+
+// appends an entry for the flat image to the frame's part of the table
+static void
+appendFlatEntry(Engine* engine, uint32_t* entry, const uint32_t flat)
+{
+    engine->compLayers[*entry]               = COMP_LAYER_FIXED;
+    engine->layerTable->layers[*entry]       = (CompLayer){
+        .image     = COMP_IMAGE_FLAT + flat,
+        .opacity   = 1,
+        .blendMode = DALI_BLEND_MODE_OVER,
+        .flags     = COMP_LAYER_FLATTENED_BIT,
+        .occupancy = OCC_ROW_FLAT + flat};
+    (*entry)++;
+}
+
+// blends the stack into imageA. the layers below the active one, and the run
+// of layers at the top that are blended over, can each be flattened into an
+// image once and reused for as long as they stay the same. each frame then
+// only blends the active layer and the layers between it and that run.
+static void
+comp(Engine* engine, Frame* frame, Dali_LayerStack* stack,
+     const VkCommandBuffer cmdBuf)
+{
+    dali_CmdBeginStage(&engine->profiler, engine->frameIndex, cmdBuf,
+                       DALI_STAGE_COMPOSITE);
 
-    VkImageSubresourceRange imageRange = {
+    reserveFrameLayers(engine, frame);
+
+    const VkImageSubresourceRange subResRange = {
         .aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
-        .baseArrayLayer = 0,
         .baseMipLevel   = 0,
         .levelCount     = 1,
-        .layerCount     = 1,
-    };
+        .baseArrayLayer = 0,
+        .layerCount     = 1};
 
-    VkImageMemoryBarrier imgBarrier0 = {
+    // every texel is written, so the last composite can be discarded once the
+    // scene is done sampling it
+    const VkImageMemoryBarrier toWrite = {
         .sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
         .image            = engine->imageA.handle,
-        .oldLayout        = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        .newLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        .subresourceRange = imageRange,
+        .oldLayout        = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout        = VK_IMAGE_LAYOUT_GENERAL,
+        .subresourceRange = subResRange,
         .srcAccessMask    = 0,
-        .dstAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT,
-    };
+        .dstAccessMask    = VK_ACCESS_SHADER_WRITE_BIT};
 
-    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
-                         &imgBarrier0);
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0,
+                         NULL, 1, &toWrite);
+
+    // blends over the layers below it commute with nothing, so only a run
+    // reaching the top of the stack can be flattened
+    const CompLayerTable* table = engine->layerTable;
+    const uint32_t        count = table->count;
+    uint32_t              above = count;
+    while (above > engine->compAbove &&
+           table->layers[above - 1].blendMode == DALI_BLEND_MODE_OVER)
+        above--;
+    // flattening a single layer would only copy it
+    const uint32_t below = engine->compBelow > 1 ? engine->compBelow : 0;
+    if (count - above < 2)
+        above = count;
+
+    // the frame's entries follow the visible layers. a run left without a flat
+    // image is blended layer by layer.
+    bool     kept[FLAT_IMAGE_COUNT] = {0};
+    uint32_t entry                  = count;
+    const int flatBelow =
+        below > 0 ? cmdFlatten(engine, frame, cmdBuf, stack, 0, below, kept)
+                  : -1;
+    const int flatAbove =
+        above < count
+            ? cmdFlatten(engine, frame, cmdBuf, stack, above, count, kept)
+            : -1;
+    if (flatBelow >= 0)
+        appendFlatEntry(engine, &entry, flatBelow);
+    const uint32_t first = flatBelow >= 0 ? below : 0;
+    const uint32_t last  = flatAbove >= 0 ? above : count;
+    for (uint32_t i = first; i < last; i++, entry++)
+    {
+        engine->compLayers[entry]        = engine->compLayers[i];
+        engine->layerTable->layers[entry] = table->layers[i];
+    }
+    if (flatAbove >= 0)
+        appendFlatEntry(engine, &entry, flatAbove);
 
-    vkCmdClearColorImage(cmdBuf, engine->imageA.handle,
-                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColor, 1,
-                         &imageRange);
+    // the rows of the layers and flat images the table refers to
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const Dali_LayerId id = engine->compLayers[i];
+        packOccupancy(engine, frame, OCC_ROW_LAYERS + id,
+                      id == engine->curLayerId
+                          ? NULL
+                          : dali_GetLayer(stack, id)->occupancy);
+    }
+    for (int i = 0; i < engine->flatCount; i++)
+    {
+        if (kept[i])
+            packOccupancy(engine, frame, OCC_ROW_FLAT + i,
+                          engine->flatImages[i].occupancy);
+    }
+
+    cmdCompositeRange(engine, frame, cmdBuf, stack, count, entry,
+                      COMP_TARGET_COMPOSITE);
 
-    VkImageMemoryBarrier imgBarrier1 = {
+    // the images each entry was read from are only known now
+    memcpy(frame->layerTableRegion.hostData, engine->layerTable,
+           sizeof(CompLayerTable) + sizeof(CompLayer) * entry);
+
+    // the scene samples the composite
+    const VkImageMemoryBarrier toRead = {
         .sType            = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
         .image            = engine->imageA.handle,
-        .oldLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        .newLayout        = VK_IMAGE_LAYOUT_GENERAL,
-        .subresourceRange = imageRange,
-        .srcAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT,
-        .dstAccessMask    = VK_ACCESS_SHADER_WRITE_BIT};
+        .oldLayout        = VK_IMAGE_LAYOUT_GENERAL,
+        .newLayout        = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .subresourceRange = subResRange,
+        .srcAccessMask    = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask    = VK_ACCESS_SHADER_READ_BIT};
 
-    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 0,
-                         NULL, 0, NULL, 1, &imgBarrier1);
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0,
+                         NULL, 1, &toRead);
+
+    dali_CmdEndStage(&engine->profiler, engine->frameIndex, cmdBuf,
+                     DALI_STAGE_COMPOSITE);
+}
+
+// tiles are only journaled or swapped once every frame in flight has handed
+// in its dirty marks. a backup ends every stroke, so this waits on the frames
+// alone rather than on everything else the device is doing.
+static bool
+collectAllDirtyTiles(Engine* engine)
+{
+    waitForFrames(engine);
+    bool any = false;
+    for (int i = 0; i < DALI_FRAMES_IN_FLIGHT; i++)
+        any |= collectDirtyTiles(engine, &engine->frames[i]);
+    return any;
+}
+
+static Dali_PaintTimeline
+sync(Engine* engine, Frame* frame, const Obdn_Scene* scene,
+     Dali_LayerStack* stack, const Dali_Brush* brush, Dali_UndoManager* u)
+{
+    Dali_PaintTimeline         timeline  = {engine->graphicsTimeline, 0, 0};
+    const Obdn_SceneDirtyFlags sceneDirt = obdn_GetSceneDirt(scene);
+    reserveLayers(engine, dali_GetLayerCount(stack));
+    finishTrim(engine, stack, false);
+    const bool journal = (u->dirt & (UNDO_BIT | REDO_BIT)) ||
+                         (stack->dirt & (LAYER_CHANGED_BIT | LAYER_BACKUP_BIT));
+    if (journal ? collectAllDirtyTiles(engine) : collectDirtyTiles(engine, frame))
+    {
+        dali_ClearRedo(u); // new paint invalidates anything undone
+        dali_GetLayer(stack, engine->curLayerId)->version++;
+    }
+    collectDabBounds(engine, frame);
+    if (brush->dirt || sceneDirt || stack->dirt || u->dirt)
+    {
+        if (sceneDirt & OBDN_SCENE_CAMERA_VIEW_BIT)
+            updateView(engine, scene);
+        if (sceneDirt & OBDN_SCENE_CAMERA_PROJ_BIT)
+            updateProj(engine, scene);
+        if (brush->dirt & BRUSH_BIT)
+            updateBrush(engine, brush);
+        if (sceneDirt & OBDN_SCENE_PRIMS_BIT)
+            updatePrim(engine, scene);
+        if (u->dirt & UNDO_BIT)
+            undo(engine, stack, u);
+        if (u->dirt & REDO_BIT)
+            redo(engine, stack, u);
+        if (stack->dirt & LAYER_CHANGED_BIT)
+        {
+            onLayerChange(engine, stack, u, stack->activeLayer);
+        }
+        if (stack->dirt & (LAYER_CHANGED_BIT | LAYER_COMPOSITE_BIT))
+            updateLayerTable(engine, stack);
+        if (stack->dirt & LAYER_BACKUP_BIT)
+            backupLayer(engine, stack, u);
+        if (submitSyncCommands(engine))
+            timeline.waitValue = engine->syncValue;
+        if (brush->dirt & PAINT_MODE_BIT)
+            engine->paintMode = brush->mode;
+    }
+    return timeline;
+}
+
+static void
+updateCommands(Engine* engine, Frame* frame, Dali_LayerStack* stack,
+               VkCommandBuffer cmdBuf)
+{
+    memcpy(frame->matrixRegion.hostData, &engine->uboMatrices,
+           sizeof(UboMatrices));
+    memcpy(frame->brushRegion.hostData, &engine->uboBrush, sizeof(UboBrush));
 
     if (engine->brushActive)
     {
         static const float unit = 0.001; // in screen space
         const float        brushDist =
             coal_Distance(engine->brushPos, engine->prevBrushPos);
-        const int splatCount = MIN(MAX(brushDist / unit, 1), 30);
+        const int splatCount = MIN(MAX(brushDist / unit, 1), MAX_DABS);
+        Vec2*     dabs       = (Vec2*)frame->dabRegion.hostData;
         for (int i = 0; i < splatCount; i++)
         {
             float t     = (float)i / splatCount;
             float xstep = t * (engine->brushPos.x - engine->prevBrushPos.x);
             float ystep = t * (engine->brushPos.y - engine->prevBrushPos.y);
-            float x     = engine->prevBrushPos.x + xstep;
-            float y     = engine->prevBrushPos.y + ystep;
+            dabs[i].x   = engine->prevBrushPos.x + xstep;
+            dabs[i].y   = engine->prevBrushPos.y + ystep;
+        }
 
-            splat(engine, cmdBuf, x, y);
+        resetDabBounds(frame, splatCount, engine->brushRadius);
 
-            applyPaint(engine, cmdBuf);
+        splat(engine, frame, cmdBuf, splatCount, dabLaunchSize(engine));
 
-            vkCmdClearColorImage(cmdBuf, engine->imageA.handle,
-                                 VK_IMAGE_LAYOUT_GENERAL, &clearColor, 1,
-                                 &imageRange);
-        }
+        applyPaint(engine, frame, cmdBuf);
+
+        // a brush held still keeps painting where it is
+        engine->prevBrushPos   = engine->brushPos;
+        engine->compositeDirty = true;
     }
-    else
-        applyPaint(engine, cmdBuf);
 
-    comp(engine, cmdBuf);
+    if (engine->compositeDirty)
+    {
+        comp(engine, frame, stack, cmdBuf);
+        engine->compositeDirty = false;
+    }
 }
 
 static void
@@ -1553,6 +2813,23 @@ printTextureDim(const Hell_Grimoire* grim, void* enginePtr)
     hell_Print("%dx%d\n", engine->textureSize, engine->textureSize);
 }
 
+static void
+printStageTimings(const Hell_Grimoire* grim, void* enginePtr)
+{
+    Engine* engine = (Engine*)enginePtr;
+    hell_Print("%-12s %8s %8s %8s %8s\n", "stage", "runs", "min ms", "avg ms",
+               "p99 ms");
+    for (int i = 0; i < DALI_STAGE_COUNT; i++)
+    {
+        Dali_StageTiming t;
+        dali_GetStageTiming(engine, i, &t);
+        if (t.samples == 0)
+            continue;
+        hell_Print("%-12s %8d %8.3f %8.3f %8.3f\n", dali_GetStageName(i),
+                   t.samples, t.min, t.avg, t.p99);
+    }
+}
+
 // TODO: see if we can do this by pass a layerstack instead of the engine
 void
 dali_SavePaintImage(Dali_Engine* engine)
@@ -1610,18 +2887,75 @@ savePaintCmd(const Hell_Grimoire* grim, void* pengine)
     obdn_SaveImage(engine->memory, &engine->imageA, fileType, strbuf);
 }
 
-VkSemaphore 
+bool
+dali_NeedsPaint(const Dali_Engine* engine, const Obdn_Scene* scene,
+                const Dali_Brush* brush, const Dali_LayerStack* stack,
+                const Dali_UndoManager* um)
+{
+    return engine->brushActive || engine->compositeDirty || brush->dirt ||
+           stack->dirt || um->dirt || obdn_GetSceneDirt(scene);
+}
+
+bool
+dali_HasPendingWork(const Dali_Engine* engine)
+{
+    return engine->trimPending;
+}
+
+void
+dali_FinishPendingWork(Dali_Engine* engine, Dali_LayerStack* stack)
+{
+    finishTrim(engine, stack, false);
+}
+
+Dali_PaintTimeline
 dali_Paint(Dali_Engine* engine, const Obdn_Scene* scene,
            const Dali_Brush* brush, Dali_LayerStack* stack,
            Dali_UndoManager* um, VkCommandBuffer cmdbuf)
 {
-    if (obdn_GetPrimCount(scene) != 1)
+    engine->frameIndex = (engine->frameIndex + 1) % DALI_FRAMES_IN_FLIGHT;
+    Frame*             frame = &engine->frames[engine->frameIndex];
+    dali_ClearRecentSamples(&engine->profiler);
+    dali_CollectProfilerSlot(&engine->profiler, engine->frameIndex);
+    Dali_PaintTimeline timeline = sync(engine, frame, scene, stack, brush, um);
+    updateCommands(engine, frame, stack, cmdbuf);
+    frame->doneValue     = ++engine->graphicsValue;
+    timeline.signalValue = frame->doneValue;
+    return timeline;
+}
+
+// the layer sized images the resident layers and the flat images may take
+// together, and the slots the layer pool may have. the pool takes what is
+// left of the sampled images a compute shader can bind, and no more than the
+// budget: a share of the device's local memory, leaving the rest to the
+// stack's images and to the app.
+static void
+getLayerBudget(const Obdn_Instance* instance, const uint32_t texSize,
+               uint32_t* layerBudget, uint16_t* slotCapacity)
+{
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(obdn_GetPhysicalDevice(instance), &props);
+    const uint32_t bindable =
+        MIN(props.limits.maxPerStageDescriptorSampledImages,
+            props.limits.maxDescriptorSetSampledImages);
+    assert(bindable > COMP_IMAGE_SLOTS);
+
+    VkPhysicalDeviceMemoryProperties memProps;
+    vkGetPhysicalDeviceMemoryProperties(obdn_GetPhysicalDevice(instance),
+                                        &memProps);
+    VkDeviceSize heapSize = 0;
+    for (uint32_t h = 0; h < memProps.memoryHeapCount; h++)
     {
-        hell_DPrint("Currently demanding 1 prim in the scene\n");
+        if (memProps.memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            heapSize = MAX(heapSize, memProps.memoryHeaps[h].size);
     }
-    VkSemaphore waitSemaphore = sync(engine, scene, stack, brush, um);
-    updateCommands(engine, cmdbuf);
-    return waitSemaphore;
+    const VkDeviceSize layerSize =
+        (VkDeviceSize)texSize * texSize * DALI_TEXEL_SIZE;
+    const VkDeviceSize budget = heapSize / RESIDENT_HEAP_SHARE / layerSize;
+
+    *layerBudget  = MIN(MAX(budget, MIN_RESIDENT_LAYERS), UINT16_MAX);
+    *slotCapacity = MIN(MIN(bindable - COMP_IMAGE_SLOTS, MAX_LAYER_SLOTS),
+                        *layerBudget);
 }
 
 void
@@ -1640,37 +2974,71 @@ dali_CreateEngine(const Obdn_Instance* instance, Obdn_Memory* memory,
         VK_FORMAT_R8G8B8A8_UNORM; // TODO: should probably be passed in...
 
     assert(texSize > 0);
-    assert(texSize % 256 == 0);
-
-    engine->curLayerId = 0;
+    assert(texSize % DALI_TILE_SIZE == 0);
+
+    engine->tilesPerSide = texSize / DALI_TILE_SIZE;
+    engine->tileCount    = engine->tilesPerSide * engine->tilesPerSide;
+    engine->dirtyTiles   = calloc(engine->tileCount, sizeof(bool));
+    engine->storedTiles  = calloc(engine->tileCount, sizeof(bool));
+    engine->transferTiles   = calloc(engine->tileCount, sizeof(uint32_t));
+    engine->transferRegions = calloc(engine->tileCount, sizeof(BufferRegion*));
+    engine->occupancyRowSize =
+        (engine->tileCount + OCC_PER_WORD - 1) / OCC_PER_WORD;
+    for (int i = 0; i < FLAT_IMAGE_COUNT; i++)
+        engine->flatImages[i].occupancy =
+            calloc(engine->tileCount, sizeof(uint8_t));
+
+    getLayerBudget(instance, texSize, &engine->layerBudget,
+                   &engine->slotCapacity);
+    // the whole stack stays on the device, as far as the budget goes
+    engine->residentLimit = engine->slotCapacity;
+    engine->slotLayers   = calloc(engine->slotCapacity, sizeof(Dali_LayerId));
+    engine->slotUse      = calloc(engine->slotCapacity, sizeof(uint32_t));
+    reserveLayers(engine, 1);
+    dali_CreateLayerPool(memory, engine->textureSize, engine->textureFormat,
+                         &engine->layerPool);
+
+    engine->curLayerId     = 0;
+    engine->compositeDirty = true;
+    engine->rngState       = DEFAULT_SEED;
     engine->graphicsQueueFamilyIndex =
         obdn_GetQueueFamilyIndex(instance, OBDN_V_QUEUE_GRAPHICS_TYPE);
     engine->transferQueueFamilyIndex =
         obdn_GetQueueFamilyIndex(instance, OBDN_V_QUEUE_TRANSFER_TYPE);
 
-    engine->paintCommand =
-        obdn_CreateCommand(instance, OBDN_V_QUEUE_GRAPHICS_TYPE);
-
-    engine->releaseImageCommand =
+    engine->syncCommand =
         obdn_CreateCommand(instance, OBDN_V_QUEUE_GRAPHICS_TYPE);
-    engine->transferImageCommand =
+    engine->drainCommand =
         obdn_CreateCommand(instance, OBDN_V_QUEUE_TRANSFER_TYPE);
-    engine->acquireImageCommand =
-        obdn_CreateCommand(instance, OBDN_V_QUEUE_GRAPHICS_TYPE);
+    vkGetDeviceQueue(engine->device, engine->transferQueueFamilyIndex, 0,
+                     &engine->transferQueue);
+    engine->graphicsTimeline = createTimeline(engine->device);
+    engine->transferTimeline = createTimeline(engine->device);
+    engine->graphicsValue    = 0;
+    engine->syncValue        = 0;
+    engine->transferValue    = 0;
+    engine->trimPending      = false;
+    dali_CreateProfiler(instance, PROFILER_SLOT_COUNT, &engine->profiler);
 
     initPaintImages(engine);
 
     initRenderPasses(engine);
     initDescSetsAndPipeLayouts(engine);
     initUniformBuffers(engine);
+    engine->pipelineCache = dali_LoadPipelineCache(instance);
     initPaintPipelineAndShaderBindingTable(engine);
-    initCompPipelines(engine, OBDN_R_BLEND_MODE_OVER);
+    initCompPipelines(engine);
+    engine->paintMode = brush->mode;
+    // saved now as well as on destroy, so a crash doesn't cost the next
+    // startup its compiles
+    dali_SavePipelineCache(instance, engine->pipelineCache);
 
     initFramebuffers(engine);
 
     assert(engine->imageA.size > 0);
 
-    updateDescSetPaint(engine);
+    for (int i = 0; i < DALI_FRAMES_IN_FLIGHT; i++)
+        updateDescSetPaint(engine, &engine->frames[i]);
     updateDescSetComp(engine);
 
     Obdn_TextureHandle  tex = obdn_SceneCreateTexture(scene, engine->imageA);
@@ -1681,6 +3049,7 @@ dali_CreateEngine(const Obdn_Instance* instance, Obdn_Memory* memory,
     {
         hell_AddCommand(grimoire, "texsize", printTextureDim, engine);
         hell_AddCommand(grimoire, "savepaint", savePaintCmd, engine);
+        hell_AddCommand(grimoire, "gputimes", printStageTimings, engine);
     }
 
     hell_Print("PAINT: initialized.\n");
@@ -1689,39 +3058,66 @@ dali_CreateEngine(const Obdn_Instance* instance, Obdn_Memory* memory,
 void
 dali_DestroyEngine(Engine* engine)
 {
-    obdn_FreeBufferRegion(&engine->matrixRegion);
-    obdn_FreeBufferRegion(&engine->brushRegion);
+    waitTimeline(engine, engine->graphicsTimeline, engine->graphicsValue);
+    waitForDrain(engine);
+    for (int i = 0; i < DALI_FRAMES_IN_FLIGHT; i++)
+    {
+        Frame* frame = &engine->frames[i];
+        obdn_FreeBufferRegion(&frame->matrixRegion);
+        obdn_FreeBufferRegion(&frame->brushRegion);
+        obdn_FreeBufferRegion(&frame->dirtyTileRegion);
+        obdn_FreeBufferRegion(&frame->dabRegion);
+        obdn_FreeBufferRegion(&frame->dabBoundsRegion);
+        obdn_FreeBufferRegion(&frame->layerTableRegion);
+        obdn_FreeBufferRegion(&frame->occupancyRegion);
+    }
+    if (engine->stagingRegion.size) // only there once something was backed up
+        obdn_FreeBufferRegion(&engine->stagingRegion);
+    free(engine->dirtyTiles);
+    free(engine->storedTiles);
+    free(engine->transferTiles);
+    free(engine->transferRegions);
     vkDestroyPipeline(engine->device, engine->paintPipeline, NULL);
+    dali_SavePipelineCache(engine->instance, engine->pipelineCache);
+    dali_DestroyPipelineCache(engine->instance, engine->pipelineCache);
     vkDestroyPipelineLayout(engine->device, engine->pipelineLayout, NULL);
     obdn_DestroyShaderBindingTable(&engine->shaderBindingTable);
     for (int i = 0; i < PIPELINE_COMP_COUNT; i++)
     {
         vkDestroyPipeline(engine->device, engine->compPipelines[i], NULL);
     }
+    vkDestroyPipeline(engine->device, engine->compositePipeline, NULL);
     for (int i = 0; i < DESC_SET_COUNT; i++)
     {
         vkDestroyDescriptorSetLayout(engine->device,
                                      engine->descriptorSetLayouts[i], NULL);
     }
     obdn_DestroyDescription(engine->device, &engine->description);
-    obdn_DestroyCommand(engine->releaseImageCommand);
-    obdn_DestroyCommand(engine->transferImageCommand);
-    obdn_DestroyCommand(engine->acquireImageCommand);
-    obdn_DestroyCommand(engine->paintCommand);
+    obdn_DestroyDescription(engine->device, &engine->frameDescription);
+    obdn_DestroyCommand(engine->syncCommand);
+    obdn_DestroyCommand(engine->drainCommand);
+    vkDestroySemaphore(engine->device, engine->graphicsTimeline, NULL);
+    vkDestroySemaphore(engine->device, engine->transferTimeline, NULL);
+    dali_DestroyProfiler(&engine->profiler);
+    obdn_FreeImage(&engine->stampImage);
     obdn_FreeImage(&engine->imageA);
     obdn_FreeImage(&engine->imageB);
-    obdn_FreeImage(&engine->imageC);
-    obdn_FreeImage(&engine->imageD);
+    for (int i = 0; i < FLAT_IMAGE_COUNT; i++)
+    {
+        if (i < engine->flatCount)
+            obdn_FreeImage(&engine->flatImages[i].image);
+        free(engine->flatImages[i].layers);
+        free(engine->flatImages[i].occupancy);
+    }
+    free(engine->layerTable);
+    free(engine->compLayers);
+    free(engine->layerSlots);
+    free(engine->slotLayers);
+    free(engine->slotUse);
+    dali_DestroyLayerPool(&engine->layerPool);
     vkDestroyFramebuffer(engine->device, engine->applyPaintFrameBuffer, NULL);
-    vkDestroyFramebuffer(engine->device, engine->compositeFrameBuffer, NULL);
-    vkDestroyFramebuffer(engine->device, engine->backgroundFrameBuffer, NULL);
-    vkDestroyFramebuffer(engine->device, engine->foregroundFrameBuffer, NULL);
-    vkDestroyRenderPass(engine->device, engine->singleCompositeRenderPass,
-                        NULL);
     vkDestroyRenderPass(engine->device, engine->applyPaintRenderPass, NULL);
-    vkDestroyRenderPass(engine->device, engine->compositeRenderPass, NULL);
-    obdn_DestroyAccelerationStruct(engine->device, &engine->bottomLevelAS);
-    obdn_DestroyAccelerationStruct(engine->device, &engine->topLevelAS);
+    destroyPrimStructures(engine);
 }
 Dali_Engine*
 dali_AllocEngine(void)
@@ -1729,6 +3125,31 @@ dali_AllocEngine(void)
     return hell_Malloc(sizeof(Dali_Engine));
 }
 
+void
+dali_SeedEngine(Dali_Engine* engine, uint64_t seed)
+{
+    // xorshift never leaves 0
+    engine->rngState = seed ? seed : DEFAULT_SEED;
+}
+
+void
+dali_SetResidentLayerCount(Dali_Engine* engine, uint16_t count)
+{
+    engine->residentLimit = MIN(MAX(count, 1), engine->slotCapacity);
+}
+
+uint16_t
+dali_GetResidentLayerLimit(const Dali_Engine* engine)
+{
+    return engine->slotCapacity;
+}
+
+uint64_t
+dali_GetLayerUploadCount(const Dali_Engine* engine)
+{
+    return engine->uploadCount;
+}
+
 Obdn_MaterialHandle 
 dali_GetPaintMaterial(Engine* engine)
 {
@@ -1746,3 +3167,42 @@ dali_GetActivePrim(Dali_Engine* engine)
 {
     return engine->activePrim;
 }
+
+void
+dali_GetStageTiming(const Dali_Engine* engine, Dali_Stage stage,
+                    Dali_StageTiming* timing)
+{
+    dali_GetProfilerTiming(&engine->profiler, stage, timing);
+}
+
+float
+dali_GetFrameStageTime(const Dali_Engine* engine, Dali_Stage stage)
+{
+    return engine->profiler.recentMs[stage];
+}
+
+VkDeviceSize
+dali_GetEngineImageMemoryBound(const Obdn_Instance* instance,
+                               const uint32_t texSize,
+                               const uint16_t residentCount)
+{
+    uint32_t layerBudget;
+    uint16_t slotCapacity;
+    getLayerBudget(instance, texSize, &layerBudget, &slotCapacity);
+    const uint32_t resident = MIN(MAX(residentCount, 1), slotCapacity);
+    // the flat images only take what the slots leave of the budget
+    const uint32_t layers = MIN(resident + FLAT_IMAGE_COUNT, layerBudget);
+    // imageA, imageB and the stamp, whose texels are as large as a layer's
+    return (VkDeviceSize)(3 + layers) * texSize * texSize * DALI_TEXEL_SIZE;
+}
+
+VkDeviceSize
+dali_GetEngineMemoryUsage(const Dali_Engine* engine)
+{
+    VkDeviceSize size = engine->imageA.size + engine->imageB.size +
+                        engine->stampImage.size + engine->stagingRegion.size +
+                        dali_GetLayerPoolMemoryUsage(&engine->layerPool);
+    for (int i = 0; i < engine->flatCount; i++)
+        size += engine->flatImages[i].image.size;
+    return size;
+}
@@ -11,18 +11,98 @@
 #define IMG_8K IMG_4K * 2
 #define IMG_16K IMG_8K * 2
 
+// paint commands recorded by one call to dali_Paint may still be executing
+// while this many more are recorded
+#define DALI_FRAMES_IN_FLIGHT 2
+
 typedef struct Dali_Engine Dali_Engine;
 
-// grimoire is optional
+// the points on the engine's timeline semaphore that the submission of a
+// dali_Paint cmdbuf waits on and signals
+typedef struct Dali_PaintTimeline {
+    VkSemaphore semaphore;
+    uint64_t    waitValue;   // 0 if there is nothing to wait on
+    uint64_t    signalValue;
+} Dali_PaintTimeline;
+
+// the stages of dali_Paint the engine times, see dali_GetStageTiming
+typedef enum Dali_Stage {
+    DALI_STAGE_SPLAT,        // tracing the frame's dabs into the stamp
+    DALI_STAGE_APPLY,        // blending the stamp onto the layer
+    DALI_STAGE_CLEAR_STAMP,  // clearing the stamp for the next frame
+    DALI_STAGE_COMPOSITE,    // compositing the stack into the painted texture
+    DALI_STAGE_LAYER_CHANGE, // storing the old layer and loading the new one
+    DALI_STAGE_RESTORE,      // uploading the tiles an undo or redo swapped
+    DALI_STAGE_BACKUP,       // capturing the tiles of a backup
+    DALI_STAGE_PRIM,         // building the scene's acceleration structures
+    DALI_STAGE_COUNT
+} Dali_Stage;
+
+// in milliseconds of device time, over a stage's most recent runs
+typedef struct Dali_StageTiming {
+    uint32_t samples; // 0 if the stage has not run yet
+    float    min;
+    float    avg;
+    float    p99;
+} Dali_StageTiming;
+
+// grimoire is optional. the stack is composited by indexing an array of
+// its layers, so the device must have runtime descriptor arrays, partially
+// bound descriptors, descriptor binding update unused while pending and
+// non-uniform sampled image indexing enabled.
 void dali_CreateEngine(const Obdn_Instance* instance, Obdn_Memory* memory,
                        Dali_UndoManager* undo, Obdn_Scene* scene,
                        const Dali_Brush* brush, const uint32_t texSize,
                        Hell_Grimoire* grimoire, Dali_Engine* engine);
-VkSemaphore dali_Paint(Dali_Engine* engine, const Obdn_Scene* scene,
-                       const Dali_Brush* brush, Dali_LayerStack* stack,
-                       Dali_UndoManager* um, VkCommandBuffer cmdbuf);
+// records the paint commands into cmdbuf, which may be left empty if there
+// was nothing to paint. every earlier cmdbuf must have been submitted, and the
+// one recorded DALI_FRAMES_IN_FLIGHT calls ago must have completed, since the
+// resources it used are reused here. if undo, redo, a layer change or a
+// backup had to touch the paint images first, the submission of cmdbuf must
+// wait on the returned waitValue. it must always signal signalValue, which is
+// how the engine knows the frame is done when it has to wait for the frames
+// in flight. the device must have timeline semaphores enabled.
+Dali_PaintTimeline dali_Paint(Dali_Engine* engine, const Obdn_Scene* scene,
+                              const Dali_Brush* brush, Dali_LayerStack* stack,
+                              Dali_UndoManager* um, VkCommandBuffer cmdbuf);
+// whether dali_Paint has anything to do. when it returns false the painted
+// texture is up to date and dali_Paint can be skipped.
+bool        dali_NeedsPaint(const Dali_Engine* engine, const Obdn_Scene* scene,
+                            const Dali_Brush* brush,
+                            const Dali_LayerStack* stack,
+                            const Dali_UndoManager* um);
+// whether the engine has submitted work it still has to finish on the host
+// once the device is done with it: the tiles a layer change stored are
+// trimmed once they have landed. an app that skips dali_Paint while idle
+// should still call dali_FinishPendingWork every so often until this returns
+// false.
+bool        dali_HasPendingWork(const Dali_Engine* engine);
+// finishes whatever of that work the device is done with. never blocks.
+void        dali_FinishPendingWork(Dali_Engine* engine, Dali_LayerStack* stack);
 void        dali_DestroyEngine(Dali_Engine* engine);
 
+// the seed of the jitter in the rays a dab traces. the same seed and the same
+// calls from creation on paint the same texels.
+void dali_SeedEngine(Dali_Engine* engine, uint64_t seed);
+
+// the most layers kept in device memory at once. by default, and at most, as
+// many as the device can bind for the composite and a quarter of its local
+// memory holds, see dali_GetResidentLayerLimit, so a stack that fits stays on
+// the device; the stack itself has no such limit. a lower count streams the
+// rest: the copies of the most recently used layers are kept, and any other
+// layer is uploaded from the stack when it is next needed. while more layers
+// are visible than are resident, every composite uploads the ones it lacks,
+// at some cost in precision. copies are allocated from the engine's memory as
+// layers are first needed, never more than the stack has layers. what they
+// leave of that quarter goes to the images the composite flattens runs of
+// layers into. a change frees what no longer fits on the next layer change.
+void dali_SetResidentLayerCount(Dali_Engine* engine, uint16_t count);
+// the most dali_SetResidentLayerCount will keep resident, and the default
+uint16_t dali_GetResidentLayerLimit(const Dali_Engine* engine);
+// layers uploaded from the stack's host tiles so far, whenever one was needed
+// that had no device copy
+uint64_t dali_GetLayerUploadCount(const Dali_Engine* engine);
+
 Obdn_MaterialHandle dali_GetPaintMaterial(Dali_Engine* engine);
 
 void dali_SetActivePrim(Dali_Engine* engine, Obdn_PrimitiveHandle prim);
@@ -30,4 +110,28 @@ Obdn_PrimitiveHandle dali_GetActivePrim(Dali_Engine* engine);
 
 Dali_Engine* dali_AllocEngine(void);
 
+// a stage's timings are read back when the engine next reuses the commands
+// they were recorded into: for the paint stages DALI_FRAMES_IN_FLIGHT calls
+// to dali_Paint later, for undo, redo, backups and layer changes the next time
+// one of those runs. the prim stage blocks the host and is timed on it.
+void        dali_GetStageTiming(const Dali_Engine* engine, Dali_Stage stage,
+                                Dali_StageTiming* timing);
+// the milliseconds of device time a stage took in what the last dali_Paint
+// read back, 0 if it read back none: the paint stages of the frame recorded
+// DALI_FRAMES_IN_FLIGHT calls before it, the undo, redo, backup and layer
+// change work it read back, and the prim stage if it ran.
+float       dali_GetFrameStageTime(const Dali_Engine* engine, Dali_Stage stage);
+// bytes of device memory the engine's images and staging buffer take up: the
+// composite, the active layer, the stamp, the resident layers and the flat
+// images. the stack and the undo manager report their own.
+VkDeviceSize dali_GetEngineMemoryUsage(const Dali_Engine* engine);
+// the most device image memory an engine of this texture size will allocate
+// with residentCount layers resident, set before its first dali_Paint. for
+// sizing the Obdn_Memory it is created with. its staging buffer for backups
+// comes out of the device buffers, and grows to the size of a layer.
+VkDeviceSize dali_GetEngineImageMemoryBound(const Obdn_Instance* instance,
+                                            const uint32_t texSize,
+                                            const uint16_t residentCount);
+const char* dali_GetStageName(Dali_Stage stage);
+
 #endif /* end of include guard: PAINT_H */
@@ -4,48 +4,73 @@
 #include <obsidian/image.h>
 #include <hell/debug.h>
 #include <hell/common.h>
+#include <hell/minmax.h>
 #include "dtags.h"
 #include <string.h>
+#include <stdlib.h>
 
 typedef Dali_Layer   Layer;
 typedef Dali_LayerId LayerId;
 
-void dali_CreateLayerStack(Obdn_Memory* memory, const VkDeviceSize textureSize, Dali_LayerStack* layerStack)
+void dali_CreateLayerStack(Obdn_Memory* memory, const uint32_t textureSize, Dali_LayerStack* layerStack)
 {
+    assert(textureSize > 0);
+    assert(textureSize % DALI_TILE_SIZE == 0);
     memset(layerStack, 0, sizeof(Dali_LayerStack));
-    layerStack->layerSize  = textureSize;
-    layerStack->memory = memory;
+    layerStack->textureSize  = textureSize;
+    layerStack->tilesPerSide = textureSize / DALI_TILE_SIZE;
+    layerStack->tileCount    = layerStack->tilesPerSide * layerStack->tilesPerSide;
+    layerStack->tileSize     = DALI_TILE_SIZE * DALI_TILE_SIZE * DALI_TEXEL_SIZE;
+    layerStack->layerSize    = layerStack->tileSize * layerStack->tileCount;
+    dali_CreateTilePool(memory, layerStack->tileSize, &layerStack->tilePool);
 
-    layerStack->backBuffer  = obdn_RequestBufferRegion(memory, textureSize, 
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 
-            OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
-
-    layerStack->frontBuffer = obdn_RequestBufferRegion(memory, textureSize, 
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 
-            OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
+    layerStack->emptyTile = obdn_RequestBufferRegion(memory, layerStack->tileSize, 
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT, OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
+    memset(layerStack->emptyTile.hostData, 0, layerStack->tileSize);
 
     dali_CreateLayer(layerStack); // create one layer to start
 }
 
 void dali_DestroyLayerStack(Dali_LayerStack* layerStack)
 {
-    obdn_FreeBufferRegion(&layerStack->backBuffer);
-    obdn_FreeBufferRegion(&layerStack->frontBuffer);
-    for (int i = 0; i < layerStack->layerCount; i++)
+    obdn_FreeBufferRegion(&layerStack->emptyTile);
+    for (uint16_t i = 0; i < layerStack->layerCount; i++)
     {
-        obdn_FreeBufferRegion(&layerStack->layers[i].bufferRegion);
+        free(layerStack->layers[i].tiles);
+        free(layerStack->layers[i].occupancy);
     }
+    // the tiles go with it
+    dali_DestroyTilePool(&layerStack->tilePool);
+    free(layerStack->layers);
+    free(layerStack->order);
     memset(layerStack, 0, sizeof(Dali_LayerStack));
 }
 
 int dali_CreateLayer(Dali_LayerStack* layerStack)
 {
-    assert(layerStack->layerCount < MAX_LAYERS);
+    // ids stop short of UINT16_MAX, which the engine keeps for itself
+    assert(layerStack->layerCount < UINT16_MAX);
+    if (layerStack->layerCount == layerStack->layerCapacity)
+    {
+        layerStack->layerCapacity = layerStack->layerCapacity ? MIN(layerStack->layerCapacity * 2, UINT16_MAX) : 8;
+        layerStack->layers = realloc(layerStack->layers, sizeof(Layer) * layerStack->layerCapacity);
+        layerStack->order  = realloc(layerStack->order, sizeof(LayerId) * layerStack->layerCapacity);
+        assert(layerStack->layers);
+        assert(layerStack->order);
+    }
     const uint16_t curId = layerStack->layerCount++;
 
-    layerStack->layers[curId].bufferRegion = obdn_RequestBufferRegion(layerStack->memory, layerStack->layerSize, 
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 
-            OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
+    Layer* layer = &layerStack->layers[curId];
+    memset(layer, 0, sizeof(Layer));
+    // no tile is backed until something is written to it
+    layer->tiles = calloc(layerStack->tileCount, sizeof(Obdn_V_BufferRegion));
+    assert(layer->tiles);
+    layer->occupancy = calloc(layerStack->tileCount, sizeof(uint8_t));
+    assert(layer->occupancy);
+    layer->opacity   = 1.0;
+    layer->blendMode = DALI_BLEND_MODE_OVER;
+    layer->visible   = true;
+    layerStack->order[curId] = curId;
     
     hell_DebugPrint(PAINT_DEBUG_TAG_LAYER, "Layer created!");
     hell_Print("Adding layer. There are now %d layers. Active layer is %d\n", layerStack->layerCount, layerStack->activeLayer);
@@ -69,6 +94,15 @@ Layer* dali_GetLayer(Dali_LayerStack* layerStack, LayerId id)
     return &layerStack->layers[id];
 }
 
+void dali_SetActiveLayer(Dali_LayerStack* layerStack, uint16_t id)
+{
+    assert(id < layerStack->layerCount);
+    if (id == layerStack->activeLayer)
+        return;
+    layerStack->activeLayer = id;
+    layerStack->dirt |= LAYER_CHANGED_BIT;
+}
+
 bool dali_IncrementLayer(Dali_LayerStack* layerStack, LayerId* const id)
 {
     *id = layerStack->activeLayer + 1;
@@ -81,7 +115,7 @@ bool dali_IncrementLayer(Dali_LayerStack* layerStack, LayerId* const id)
     }
 }
 
-bool l_DecrementLayer(Dali_LayerStack* layerStack, LayerId* const id)
+bool dali_DecrementLayer(Dali_LayerStack* layerStack, LayerId* const id)
 {
     *id = layerStack->activeLayer - 1;
     if (*id >= layerStack->layerCount) // negatives will wrap around
@@ -93,13 +127,231 @@ bool l_DecrementLayer(Dali_LayerStack* layerStack, LayerId* const id)
     }
 }
 
-uint8_t* dali_CopyTextureToLayer(Dali_LayerStack* layerStack, const LayerId id, const void* data, uint32_t w, uint32_t h, VkFormat format)
+void dali_SetLayerOpacity(Dali_LayerStack* layerStack, const LayerId id, const float opacity)
+{
+    assert(id < layerStack->layerCount);
+    layerStack->layers[id].opacity = MIN(MAX(opacity, 0.0), 1.0);
+    layerStack->dirt |= LAYER_COMPOSITE_BIT;
+}
+
+float dali_GetLayerOpacity(const Dali_LayerStack* layerStack, const LayerId id)
+{
+    assert(id < layerStack->layerCount);
+    return layerStack->layers[id].opacity;
+}
+
+void dali_SetLayerBlendMode(Dali_LayerStack* layerStack, const LayerId id, const Dali_BlendMode mode)
+{
+    assert(id < layerStack->layerCount);
+    assert(mode < DALI_BLEND_MODE_COUNT);
+    layerStack->layers[id].blendMode = mode;
+    layerStack->dirt |= LAYER_COMPOSITE_BIT;
+}
+
+Dali_BlendMode dali_GetLayerBlendMode(const Dali_LayerStack* layerStack, const LayerId id)
+{
+    assert(id < layerStack->layerCount);
+    return layerStack->layers[id].blendMode;
+}
+
+void dali_SetLayerVisible(Dali_LayerStack* layerStack, const LayerId id, const bool visible)
+{
+    assert(id < layerStack->layerCount);
+    layerStack->layers[id].visible = visible;
+    layerStack->dirt |= LAYER_COMPOSITE_BIT;
+}
+
+bool dali_GetLayerVisible(const Dali_LayerStack* layerStack, const LayerId id)
+{
+    assert(id < layerStack->layerCount);
+    return layerStack->layers[id].visible;
+}
+
+uint16_t dali_GetLayerPosition(const Dali_LayerStack* layerStack, const LayerId id)
+{
+    assert(id < layerStack->layerCount);
+    for (uint16_t i = 0; i < layerStack->layerCount; i++)
+    {
+        if (layerStack->order[i] == id)
+            return i;
+    }
+    assert(0 && "layer missing from the stack order");
+    return 0;
+}
+
+void dali_MoveLayer(Dali_LayerStack* layerStack, const LayerId id, const uint16_t position)
+{
+    assert(position < layerStack->layerCount);
+    const uint16_t from = dali_GetLayerPosition(layerStack, id);
+    if (from == position)
+        return;
+    // shift the layers in between over by one
+    LayerId* order = layerStack->order;
+    if (from < position)
+        memmove(order + from, order + from + 1, sizeof(LayerId) * (position - from));
+    else
+        memmove(order + position + 1, order + position, sizeof(LayerId) * (from - position));
+    order[position] = id;
+    layerStack->dirt |= LAYER_COMPOSITE_BIT;
+}
+
+uint32_t dali_GetLayerTileCount(const Dali_LayerStack* layerStack)
+{
+    return layerStack->tileCount;
+}
+
+uint32_t dali_GetLayerTilesPerSide(const Dali_LayerStack* layerStack)
+{
+    return layerStack->tilesPerSide;
+}
+
+bool dali_LayerTileIsEmpty(const Dali_LayerStack* layerStack, const LayerId id, const uint32_t tile)
 {
     assert(id < layerStack->layerCount);
-    assert(w == h && w == 4096);
-    const uint64_t size = w * h * 4;
-    memcpy(layerStack->layers[id].bufferRegion.hostData, data, size);
-    return layerStack->layers[id].bufferRegion.hostData;
+    assert(tile < layerStack->tileCount);
+    return layerStack->layers[id].tiles[tile].size == 0;
+}
+
+Dali_TileOccupancy dali_GetLayerTileOccupancy(const Dali_LayerStack* layerStack, const LayerId id, const uint32_t tile)
+{
+    assert(id < layerStack->layerCount);
+    assert(tile < layerStack->tileCount);
+    return layerStack->layers[id].occupancy[tile];
+}
+
+const Obdn_V_BufferRegion* dali_GetLayerTile(const Dali_LayerStack* layerStack, const LayerId id, const uint32_t tile)
+{
+    if (dali_LayerTileIsEmpty(layerStack, id, tile))
+        return &layerStack->emptyTile;
+    return &layerStack->layers[id].tiles[tile];
+}
+
+Obdn_V_BufferRegion* dali_AcquireLayerTile(Dali_LayerStack* layerStack, const LayerId id, const uint32_t tile)
+{
+    assert(id < layerStack->layerCount);
+    assert(tile < layerStack->tileCount);
+    Obdn_V_BufferRegion* region = &layerStack->layers[id].tiles[tile];
+    if (region->size == 0)
+    {
+        *region = dali_AllocTile(&layerStack->tilePool);
+        memset(region->hostData, 0, layerStack->tileSize);
+    }
+    // the caller is about to write it
+    layerStack->layers[id].occupancy[tile] = DALI_TILE_PARTIAL;
+    return region;
+}
+
+void dali_ReleaseLayerTile(Dali_LayerStack* layerStack, const LayerId id, const uint32_t tile)
+{
+    assert(id < layerStack->layerCount);
+    assert(tile < layerStack->tileCount);
+    Obdn_V_BufferRegion* region = &layerStack->layers[id].tiles[tile];
+    if (region->size)
+        dali_FreeTile(&layerStack->tilePool, region);
+    layerStack->layers[id].occupancy[tile] = DALI_TILE_EMPTY;
+}
+
+static bool isZero(const uint8_t* data, const size_t size)
+{
+    const uint64_t* words = (const uint64_t*)data;
+    for (size_t i = 0; i < size / sizeof(uint64_t); i++)
+    {
+        if (words[i])
+            return false;
+    }
+    return true;
+}
+
+static Dali_TileOccupancy scanTile(const uint8_t* data, const size_t size)
+{
+    bool shows = false;
+    bool hides = true;
+    for (size_t i = DALI_TEXEL_SIZE - 1; i < size; i += DALI_TEXEL_SIZE)
+    {
+        shows |= data[i] != 0;
+        hides &= data[i] == UINT8_MAX;
+    }
+    return hides ? DALI_TILE_OPAQUE : shows ? DALI_TILE_PARTIAL : DALI_TILE_EMPTY;
+}
+
+Obdn_V_BufferRegion dali_DetachLayerTile(Dali_LayerStack* layerStack, const LayerId id, const uint32_t tile)
+{
+    assert(id < layerStack->layerCount);
+    assert(tile < layerStack->tileCount);
+    Obdn_V_BufferRegion region = layerStack->layers[id].tiles[tile];
+    memset(&layerStack->layers[id].tiles[tile], 0, sizeof(Obdn_V_BufferRegion));
+    layerStack->layers[id].occupancy[tile] = DALI_TILE_EMPTY;
+    return region;
+}
+
+void dali_AttachLayerTile(Dali_LayerStack* layerStack, const LayerId id, const uint32_t tile, const Obdn_V_BufferRegion* region)
+{
+    dali_ReleaseLayerTile(layerStack, id, tile);
+    layerStack->layers[id].tiles[tile] = *region;
+    if (region->size)
+        layerStack->layers[id].occupancy[tile] = scanTile(region->hostData, layerStack->tileSize);
+}
+
+bool dali_TrimLayerTile(Dali_LayerStack* layerStack, const LayerId id, const uint32_t tile)
+{
+    if (dali_LayerTileIsEmpty(layerStack, id, tile))
+        return true;
+    const uint8_t* data = layerStack->layers[id].tiles[tile].hostData;
+    if (!isZero(data, layerStack->tileSize))
+    {
+        layerStack->layers[id].occupancy[tile] = scanTile(data, layerStack->tileSize);
+        return false;
+    }
+    dali_ReleaseLayerTile(layerStack, id, tile);
+    return true;
+}
+
+void dali_StoreLayer(Dali_LayerStack* layerStack, const LayerId id, const void* data)
+{
+    assert(id < layerStack->layerCount);
+    const size_t   rowSize   = DALI_TILE_SIZE * DALI_TEXEL_SIZE;
+    const size_t   rowStride = layerStack->textureSize * DALI_TEXEL_SIZE;
+    for (uint32_t t = 0; t < layerStack->tileCount; t++)
+    {
+        const uint32_t tx = t % layerStack->tilesPerSide;
+        const uint32_t ty = t / layerStack->tilesPerSide;
+        const uint8_t* src = (const uint8_t*)data + ty * DALI_TILE_SIZE * rowStride + tx * rowSize;
+        bool empty = true;
+        for (int row = 0; row < DALI_TILE_SIZE && empty; row++)
+            empty = isZero(src + row * rowStride, rowSize);
+        if (empty)
+        {
+            dali_ReleaseLayerTile(layerStack, id, t);
+            continue;
+        }
+        uint8_t* dst = dali_AcquireLayerTile(layerStack, id, t)->hostData;
+        for (int row = 0; row < DALI_TILE_SIZE; row++)
+            memcpy(dst + row * rowSize, src + row * rowStride, rowSize);
+        layerStack->layers[id].occupancy[t] = scanTile(dst, layerStack->tileSize);
+    }
+    layerStack->layers[id].written = true;
+    layerStack->layers[id].version++;
+    layerStack->layers[id].storeCount++;
+    layerStack->dirt |= LAYER_CHANGED_BIT;
+}
+
+void dali_CopyTextureToLayer(Dali_LayerStack* layerStack, const LayerId id, const void* data, uint32_t w, uint32_t h, VkFormat format)
+{
+    assert(id < layerStack->layerCount);
+    assert(w == h && w == layerStack->textureSize);
+    assert(format == VK_FORMAT_R8G8B8A8_UNORM);
+    dali_StoreLayer(layerStack, id, data);
+}
+
+VkDeviceSize dali_GetLayerStackMemoryUsage(const Dali_LayerStack* layerStack)
+{
+    VkDeviceSize size = 0;
+    for (uint16_t i = 0; i < layerStack->layerCount; i++)
+    {
+        for (uint32_t t = 0; t < layerStack->tileCount; t++)
+            size += layerStack->layers[i].tiles[t].size;
+    }
+    return size;
 }
 
 Dali_LayerStack* dali_AllocLayerStack(void)
@@ -107,6 +359,11 @@ Dali_LayerStack* dali_AllocLayerStack(void)
     return hell_Malloc(sizeof(Dali_LayerStack));
 }
 
+void dali_BackupLayer(Dali_LayerStack* layerStack)
+{
+    layerStack->dirt |= LAYER_BACKUP_BIT;
+}
+
 void dali_LayerStackClearDirt(Dali_LayerStack* layerStack)
 {
     layerStack->dirt = 0;
@@ -5,21 +5,83 @@
 
 typedef uint16_t Dali_LayerId;
 
+// how a layer is blended onto the layers below it
+typedef enum {
+    DALI_BLEND_MODE_OVER,
+    DALI_BLEND_MODE_MULTIPLY,
+    DALI_BLEND_MODE_SCREEN,
+    DALI_BLEND_MODE_ADD,
+    DALI_BLEND_MODE_COUNT
+} Dali_BlendMode;
+
+// how much of a layer tile is covered, so the compositor can skip tiles that
+// show nothing and the layers below tiles that hide everything
+typedef enum {
+    DALI_TILE_EMPTY,   // every texel is transparent
+    DALI_TILE_PARTIAL, // or possibly so, while its contents are unknown
+    DALI_TILE_OPAQUE,  // every texel is opaque
+} Dali_TileOccupancy;
+
 typedef struct Dali_Layer Dali_Layer;
 typedef struct Dali_LayerStack Dali_LayerStack;
 
-// returns number of layer or -1 on failure
-void        dali_CreateLayerStack(Obdn_Memory* memory, const VkDeviceSize size, Dali_LayerStack*);
+// textureSize is the resolution of one side of a layer and must be a multiple
+// of the tile size (256). layers start out with no backing memory; tiles are
+// allocated as they are written.
+void        dali_CreateLayerStack(Obdn_Memory* memory, const uint32_t textureSize, Dali_LayerStack*);
 void        dali_DestroyLayerStack(Dali_LayerStack*);
+// returns number of layer or -1 on failure. new layers go on top of the
+// stack, visible, at full opacity and blended over.
 int         dali_CreateLayer(Dali_LayerStack*);
 void        dali_SetActiveLayer(Dali_LayerStack*, uint16_t id);
 Dali_LayerId   dali_GetActiveLayerId(const Dali_LayerStack*);
 int         dali_GetLayerCount(const Dali_LayerStack*);
+// the pointer is invalidated by dali_CreateLayer, which may move the layers.
+// do not hold it across that call; keep the id instead.
 Dali_Layer*    dali_GetLayer(Dali_LayerStack*, Dali_LayerId id);
 bool        dali_IncrementLayer(Dali_LayerStack*, Dali_LayerId* const id);
 bool        dali_DecrementLayer(Dali_LayerStack*, Dali_LayerId* const id);
-// returns address to the layer data
-uint8_t*    dali_CopyTextureToLayer(Dali_LayerStack*, const Dali_LayerId id, const void* data, uint32_t w, uint32_t h, VkFormat format);
+// these only change how the stack is composited, which costs the engine a
+// single composite rather than a layer change
+void        dali_SetLayerOpacity(Dali_LayerStack*, const Dali_LayerId id, const float opacity);
+float       dali_GetLayerOpacity(const Dali_LayerStack*, const Dali_LayerId id);
+void        dali_SetLayerBlendMode(Dali_LayerStack*, const Dali_LayerId id, const Dali_BlendMode mode);
+Dali_BlendMode dali_GetLayerBlendMode(const Dali_LayerStack*, const Dali_LayerId id);
+void        dali_SetLayerVisible(Dali_LayerStack*, const Dali_LayerId id, const bool visible);
+bool        dali_GetLayerVisible(const Dali_LayerStack*, const Dali_LayerId id);
+// moves the layer to position in the stack, 0 being the bottom. ids are
+// unchanged.
+void        dali_MoveLayer(Dali_LayerStack*, const Dali_LayerId id, const uint16_t position);
+uint16_t    dali_GetLayerPosition(const Dali_LayerStack*, const Dali_LayerId id);
+// data must be a tightly packed R8G8B8A8 image the size of a layer
+void        dali_CopyTextureToLayer(Dali_LayerStack*, const Dali_LayerId id, const void* data, uint32_t w, uint32_t h, VkFormat format);
+// same as above, but all-zero tiles are released instead of stored
+void        dali_StoreLayer(Dali_LayerStack*, const Dali_LayerId id, const void* data);
+
+uint32_t    dali_GetLayerTileCount(const Dali_LayerStack*);
+uint32_t    dali_GetLayerTilesPerSide(const Dali_LayerStack*);
+bool        dali_LayerTileIsEmpty(const Dali_LayerStack*, const Dali_LayerId id, const uint32_t tile);
+// kept up to date as tiles are stored, attached, released and trimmed. a tile
+// acquired for writing counts as partially covered until it is next stored
+// or trimmed.
+Dali_TileOccupancy dali_GetLayerTileOccupancy(const Dali_LayerStack*, const Dali_LayerId id, const uint32_t tile);
+// returns the shared empty tile if the tile has no backing memory
+const Obdn_V_BufferRegion* dali_GetLayerTile(const Dali_LayerStack*, const Dali_LayerId id, const uint32_t tile);
+// allocates (zeroed) backing memory for the tile if it has none
+Obdn_V_BufferRegion*       dali_AcquireLayerTile(Dali_LayerStack*, const Dali_LayerId id, const uint32_t tile);
+void        dali_ReleaseLayerTile(Dali_LayerStack*, const Dali_LayerId id, const uint32_t tile);
+// hands the tile's region to the caller, leaving the tile empty
+Obdn_V_BufferRegion dali_DetachLayerTile(Dali_LayerStack*, const Dali_LayerId id, const uint32_t tile);
+// replaces the tile's region, freeing the old one. region may be empty.
+void        dali_AttachLayerTile(Dali_LayerStack*, const Dali_LayerId id, const uint32_t tile, const Obdn_V_BufferRegion* region);
+// releases the tile if its contents are all zero. returns true if the tile is
+// now empty
+bool        dali_TrimLayerTile(Dali_LayerStack*, const Dali_LayerId id, const uint32_t tile);
+// bytes of tile memory currently backing layers
+VkDeviceSize dali_GetLayerStackMemoryUsage(const Dali_LayerStack*);
+// records everything painted on the active layer since the last backup as
+// one undo entry. call at the end of a stroke.
+void dali_BackupLayer(Dali_LayerStack* layerStack);
 void dali_LayerStackClearDirt(Dali_LayerStack* layerStack);
 
 Dali_LayerStack* dali_AllocLayerStack(void);
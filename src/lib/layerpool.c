@@ -0,0 +1,62 @@
+#include "layerpool.h"
+#include <hell/common.h>
+#include <hell/debug.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+void
+dali_CreateLayerPool(Obdn_Memory* memory, const uint32_t size,
+                     const VkFormat format, Dali_LayerPool* pool)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->memory = memory;
+    pool->size   = size;
+    pool->format = format;
+}
+
+uint16_t
+dali_AddLayerPoolSlot(Dali_LayerPool* pool)
+{
+    assert(pool->slotCount < UINT16_MAX);
+    if (pool->slotCount == pool->slotCapacity)
+    {
+        pool->slotCapacity =
+            pool->slotCapacity ? MIN(pool->slotCapacity * 2, UINT16_MAX) : 4;
+        pool->slots =
+            realloc(pool->slots, sizeof(Obdn_V_Image) * pool->slotCapacity);
+        assert(pool->slots);
+    }
+    // the composite fetches texels, so no filtering is wanted
+    pool->slots[pool->slotCount] = obdn_CreateImageAndSampler(
+        pool->memory, pool->size, pool->size, pool->format,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        VK_IMAGE_ASPECT_COLOR_BIT, VK_SAMPLE_COUNT_1_BIT, 1, VK_FILTER_NEAREST,
+        OBDN_V_MEMORY_DEVICE_TYPE);
+    return pool->slotCount++;
+}
+
+void
+dali_TrimLayerPool(Dali_LayerPool* pool, const uint16_t slotCount)
+{
+    while (pool->slotCount > slotCount)
+        obdn_FreeImage(&pool->slots[--pool->slotCount]);
+}
+
+void
+dali_DestroyLayerPool(Dali_LayerPool* pool)
+{
+    dali_TrimLayerPool(pool, 0);
+    free(pool->slots);
+    memset(pool, 0, sizeof(*pool));
+}
+
+VkDeviceSize
+dali_GetLayerPoolMemoryUsage(const Dali_LayerPool* pool)
+{
+    VkDeviceSize size = 0;
+    for (uint16_t s = 0; s < pool->slotCount; s++)
+        size += pool->slots[s].size;
+    return size;
+}
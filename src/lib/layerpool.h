@@ -0,0 +1,33 @@
+#ifndef DALI_LAYERPOOL_H
+#define DALI_LAYERPOOL_H
+
+#include <obsidian/memory.h>
+#include <obsidian/video.h>
+
+// device copies of layers, one image per slot, so they stay on the device and
+// are copied to and from the active layer without crossing the bus. the
+// images come out of the engine's Obdn_Memory like its other images. slots
+// are added and dropped at the end, and the others keep their contents. each
+// image is sampled and is a transfer source and destination.
+
+typedef struct Dali_LayerPool {
+    Obdn_Memory*  memory;
+    Obdn_V_Image* slots;
+    uint16_t      slotCount;
+    uint16_t      slotCapacity; // slots has room for this many
+    uint32_t      size;         // of each side
+    VkFormat      format;
+} Dali_LayerPool;
+
+// starts out with no slots
+void dali_CreateLayerPool(Obdn_Memory* memory, const uint32_t size,
+                          const VkFormat format, Dali_LayerPool* pool);
+// adds a slot and returns it. it is created in UNDEFINED layout.
+uint16_t dali_AddLayerPoolSlot(Dali_LayerPool* pool);
+// frees the slots from slotCount on. nothing may be using them.
+void dali_TrimLayerPool(Dali_LayerPool* pool, const uint16_t slotCount);
+void dali_DestroyLayerPool(Dali_LayerPool* pool);
+// bytes of device memory the slots take up
+VkDeviceSize dali_GetLayerPoolMemoryUsage(const Dali_LayerPool* pool);
+
+#endif /* end of include guard: DALI_LAYERPOOL_H */
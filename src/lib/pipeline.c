@@ -0,0 +1,511 @@
+#include "pipeline.h"
+#include "dtags.h"
+#include <hell/common.h>
+#include <hell/debug.h>
+#include <hell/len.h>
+#include <obsidian/memory.h>
+#include <obsidian/video.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef UNIX
+#include <sys/stat.h>
+#elif defined(WINDOWS)
+#include <direct.h>
+#endif
+
+// every pipeline cache starts with this, see VkPipelineCacheHeaderVersionOne
+typedef struct CacheHeader {
+    uint32_t size;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint8_t  uuid[VK_UUID_SIZE];
+} CacheHeader;
+
+static VkPhysicalDeviceProperties
+getDeviceProperties(const Obdn_Instance* instance)
+{
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(obdn_GetPhysicalDevice(instance), &props);
+    return props;
+}
+
+// fills path with the cache file for this device. returns false if there is
+// nowhere to put it.
+static bool
+getCachePath(const VkPhysicalDeviceProperties* props, char* path,
+             const size_t size)
+{
+    char dir[256];
+#ifdef UNIX
+    const char* xdg  = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (xdg && xdg[0])
+        snprintf(dir, sizeof(dir), "%s/dali", xdg);
+    else if (home && home[0])
+        snprintf(dir, sizeof(dir), "%s/.cache/dali", home);
+    else
+        return false;
+    // the parent may not exist either on a fresh account
+    char parent[256];
+    snprintf(parent, sizeof(parent), "%s", dir);
+    char* slash = strrchr(parent, '/');
+    if (slash && slash != parent)
+    {
+        *slash = '\0';
+        mkdir(parent, 0700);
+    }
+    mkdir(dir, 0700);
+#elif defined(WINDOWS)
+    const char* appData = getenv("LOCALAPPDATA");
+    if (!appData || !appData[0])
+        return false;
+    snprintf(dir, sizeof(dir), "%s/dali", appData);
+    _mkdir(dir);
+#else
+    return false;
+#endif
+
+    char uuid[VK_UUID_SIZE * 2 + 1];
+    for (int i = 0; i < VK_UUID_SIZE; i++)
+        snprintf(uuid + i * 2, 3, "%02x", props->pipelineCacheUUID[i]);
+    return snprintf(path, size, "%s/pipelines-%s-%08x.bin", dir, uuid,
+                    props->driverVersion) < (int)size;
+}
+
+// true if the file at path holds exactly size bytes of data
+static bool
+fileMatches(const char* path, const void* data, const size_t size)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+    fseek(file, 0, SEEK_END);
+    bool matches = ftell(file) == (long)size;
+    fseek(file, 0, SEEK_SET);
+    if (matches)
+    {
+        void* old = hell_Malloc(size);
+        matches   = fread(old, 1, size, file) == size &&
+                  memcmp(old, data, size) == 0;
+        hell_Free(old);
+    }
+    fclose(file);
+    return matches;
+}
+
+// drivers are meant to reject foreign data themselves, but not all of them do
+static bool
+headerMatches(const VkPhysicalDeviceProperties* props, const void* data,
+              const size_t size)
+{
+    CacheHeader header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    return header.version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == props->vendorID &&
+           header.deviceID == props->deviceID &&
+           memcmp(header.uuid, props->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+VkPipelineCache
+dali_LoadPipelineCache(const Obdn_Instance* instance)
+{
+    const VkPhysicalDeviceProperties props = getDeviceProperties(instance);
+
+    void*  data = NULL;
+    size_t size = 0;
+    char   path[512];
+    FILE*  file = getCachePath(&props, path, sizeof(path)) ? fopen(path, "rb")
+                                                         : NULL;
+    if (file)
+    {
+        fseek(file, 0, SEEK_END);
+        const long len = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        if (len > 0)
+        {
+            data = hell_Malloc(len);
+            if (fread(data, 1, len, file) == (size_t)len &&
+                headerMatches(&props, data, len))
+                size = len;
+        }
+        fclose(file);
+    }
+
+    const VkPipelineCacheCreateInfo info = {
+        .sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = size,
+        .pInitialData    = size ? data : NULL};
+
+    VkPipelineCache cache;
+    V_ASSERT(vkCreatePipelineCache(obdn_GetDevice(instance), &info, NULL,
+                                   &cache));
+    if (data)
+        hell_Free(data);
+    hell_DebugPrint(PAINT_DEBUG_TAG_PIPE, "pipeline cache loaded with %ld bytes\n",
+                    (long)size);
+    return cache;
+}
+
+void
+dali_SavePipelineCache(const Obdn_Instance* instance, VkPipelineCache cache)
+{
+    const VkPhysicalDeviceProperties props = getDeviceProperties(instance);
+    const VkDevice                   device = obdn_GetDevice(instance);
+
+    char path[512];
+    if (!getCachePath(&props, path, sizeof(path)))
+        return;
+
+    size_t size = 0;
+    V_ASSERT(vkGetPipelineCacheData(device, cache, &size, NULL));
+    void* data = hell_Malloc(size);
+    V_ASSERT(vkGetPipelineCacheData(device, cache, &size, data));
+    // a cache can take in new entries without changing size, so only
+    // identical contents count as nothing new compiled
+    if (fileMatches(path, data, size))
+    {
+        hell_Free(data);
+        return;
+    }
+
+    // written aside and renamed so that another instance never reads half a
+    // file
+    char tmpPath[520];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE* file = fopen(tmpPath, "wb");
+    if (file)
+    {
+        const bool written = fwrite(data, 1, size, file) == size;
+        fclose(file);
+        if (written && rename(tmpPath, path) == 0)
+            hell_DebugPrint(PAINT_DEBUG_TAG_PIPE, "saved %ld bytes to %s\n",
+                            (long)size, path);
+        else
+            remove(tmpPath);
+    }
+    else
+        hell_Print("Pipeline cache: could not write %s\n", path);
+    hell_Free(data);
+}
+
+void
+dali_DestroyPipelineCache(const Obdn_Instance* instance, VkPipelineCache cache)
+{
+    vkDestroyPipelineCache(obdn_GetDevice(instance), cache, NULL);
+}
+
+static VkPipelineColorBlendAttachmentState
+blendAttachmentState(const Obdn_R_BlendMode mode)
+{
+    VkPipelineColorBlendAttachmentState state = {
+        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+        .colorBlendOp        = VK_BLEND_OP_ADD,
+        .alphaBlendOp        = VK_BLEND_OP_ADD,
+        .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+        .dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA};
+
+    // matches obsidian's blend modes
+    switch (mode)
+    {
+    case OBDN_R_BLEND_MODE_NONE:
+        state.blendEnable = VK_FALSE;
+        break;
+    case OBDN_R_BLEND_MODE_OVER:
+        state.blendEnable         = VK_TRUE;
+        state.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        break;
+    case OBDN_R_BLEND_MODE_OVER_STRAIGHT:
+        state.blendEnable         = VK_TRUE;
+        state.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        break;
+    case OBDN_R_BLEND_MODE_ERASE:
+        state.blendEnable         = VK_TRUE;
+        state.srcColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+        state.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        break;
+    }
+    return state;
+}
+
+static VkPipelineShaderStageCreateInfo
+shaderStage(VkDevice device, const char* path, const VkShaderStageFlags stage)
+{
+    VkPipelineShaderStageCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = stage,
+        .pName = "main"};
+    obdn_CreateShaderModule(device, path, &info.module);
+    return info;
+}
+
+void
+dali_CreateGraphicsPipelines(VkDevice device, VkPipelineCache cache,
+                             const uint32_t                   count,
+                             const Obdn_GraphicsPipelineInfo* infos,
+                             VkPipeline*                      pipelines)
+{
+    VkGraphicsPipelineCreateInfo createInfos[count];
+
+    VkPipelineShaderStageCreateInfo        stages[count][2];
+    VkViewport                             viewports[count];
+    VkRect2D                               scissors[count];
+    VkPipelineViewportStateCreateInfo      viewportStates[count];
+    VkPipelineRasterizationStateCreateInfo rasterStates[count];
+    VkPipelineMultisampleStateCreateInfo   multisampleStates[count];
+    VkPipelineColorBlendAttachmentState    attachmentStates[count];
+    VkPipelineColorBlendStateCreateInfo    blendStates[count];
+    VkPipelineDynamicStateCreateInfo       dynamicStates[count];
+    VkPipelineInputAssemblyStateCreateInfo assemblyStates[count];
+
+    // the engine's passes generate their vertices in the shader
+    const VkPipelineVertexInputStateCreateInfo vertexInput = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+
+    const VkPipelineDepthStencilStateCreateInfo depthStencil = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const Obdn_GraphicsPipelineInfo* info = &infos[i];
+
+        stages[i][0] = shaderStage(device, info->vertShader,
+                                   VK_SHADER_STAGE_VERTEX_BIT);
+        stages[i][1] = shaderStage(device, info->fragShader,
+                                   VK_SHADER_STAGE_FRAGMENT_BIT);
+
+        viewports[i] = (VkViewport){.width    = info->viewportDim.width,
+                                    .height   = info->viewportDim.height,
+                                    .maxDepth = 1.0};
+        scissors[i]  = (VkRect2D){.extent = info->viewportDim};
+
+        viewportStates[i] = (VkPipelineViewportStateCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+            .viewportCount = 1,
+            .pViewports    = &viewports[i],
+            .scissorCount  = 1,
+            .pScissors     = &scissors[i]};
+
+        assemblyStates[i] = (VkPipelineInputAssemblyStateCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+            .topology = info->primitiveTopology};
+
+        rasterStates[i] = (VkPipelineRasterizationStateCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+            .polygonMode = VK_POLYGON_MODE_FILL,
+            .cullMode    = VK_CULL_MODE_NONE,
+            .frontFace   = info->frontFace,
+            .lineWidth   = 1.0};
+
+        multisampleStates[i] = (VkPipelineMultisampleStateCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+            .rasterizationSamples = info->sampleCount};
+
+        attachmentStates[i] = blendAttachmentState(info->blendMode);
+
+        blendStates[i] = (VkPipelineColorBlendStateCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+            .attachmentCount = 1,
+            .pAttachments    = &attachmentStates[i]};
+
+        dynamicStates[i] = (VkPipelineDynamicStateCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+            .dynamicStateCount = info->dynamicStateCount,
+            .pDynamicStates    = (const VkDynamicState*)info->pDynamicStates};
+
+        createInfos[i] = (VkGraphicsPipelineCreateInfo){
+            .sType               = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .stageCount          = LEN(stages[i]),
+            .pStages             = stages[i],
+            .pVertexInputState   = &vertexInput,
+            .pInputAssemblyState = &assemblyStates[i],
+            .pViewportState      = &viewportStates[i],
+            .pRasterizationState = &rasterStates[i],
+            .pMultisampleState   = &multisampleStates[i],
+            .pDepthStencilState  = &depthStencil,
+            .pColorBlendState    = &blendStates[i],
+            .pDynamicState = info->dynamicStateCount ? &dynamicStates[i] : NULL,
+            .layout        = info->layout,
+            .renderPass    = info->renderPass,
+            .subpass       = info->subpass,
+            .basePipelineIndex = -1};
+    }
+
+    V_ASSERT(vkCreateGraphicsPipelines(device, cache, count, createInfos, NULL,
+                                       pipelines));
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        vkDestroyShaderModule(device, stages[i][0].module, NULL);
+        vkDestroyShaderModule(device, stages[i][1].module, NULL);
+    }
+}
+
+void
+dali_CreateComputePipeline(VkDevice device, VkPipelineCache cache,
+                           VkPipelineLayout layout, const char* shader,
+                           VkPipeline* pipeline)
+{
+    const VkComputePipelineCreateInfo createInfo = {
+        .sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage  = shaderStage(device, shader, VK_SHADER_STAGE_COMPUTE_BIT),
+        .layout = layout,
+        .basePipelineIndex = -1};
+
+    V_ASSERT(vkCreateComputePipelines(device, cache, 1, &createInfo, NULL,
+                                      pipeline));
+
+    vkDestroyShaderModule(device, createInfo.stage.module, NULL);
+}
+
+static VkDeviceSize
+alignUp(const VkDeviceSize x, const VkDeviceSize alignment)
+{
+    return (x + alignment - 1) / alignment * alignment;
+}
+
+// lays the group handles out as raygen, miss then hit tables, each starting
+// on a base alignment boundary
+static void
+createShaderBindingTable(const Obdn_Instance* instance, Obdn_Memory* memory,
+                         const VkPipeline                 pipeline,
+                         const Obdn_RayTracePipelineInfo* info,
+                         Obdn_R_ShaderBindingTable*       sbt)
+{
+    const VkDevice device = obdn_GetDevice(instance);
+
+    VkPhysicalDeviceRayTracingPipelinePropertiesKHR rtProps = {
+        .sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR};
+    VkPhysicalDeviceProperties2 props = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &rtProps};
+    vkGetPhysicalDeviceProperties2(obdn_GetPhysicalDevice(instance), &props);
+
+    const uint32_t groupCount =
+        info->raygenCount + info->missCount + info->chitCount;
+    const uint32_t     handleSize = rtProps.shaderGroupHandleSize;
+    const VkDeviceSize baseAlign  = rtProps.shaderGroupBaseAlignment;
+    const VkDeviceSize stride =
+        alignUp(handleSize, rtProps.shaderGroupHandleAlignment);
+
+    // a raygen record's stride has to equal its size
+    const VkDeviceSize raygenSize = alignUp(stride, baseAlign);
+    const VkDeviceSize missSize   = alignUp(stride * info->missCount, baseAlign);
+    const VkDeviceSize hitSize    = alignUp(stride * info->chitCount, baseAlign);
+    const VkDeviceSize tableSize =
+        raygenSize * info->raygenCount + missSize + hitSize;
+
+    uint8_t* handles = hell_Malloc(groupCount * handleSize);
+    V_ASSERT(vkGetRayTracingShaderGroupHandlesKHR(
+        device, pipeline, 0, groupCount, groupCount * handleSize, handles));
+
+    // room to move the start up to the base alignment
+    sbt->bufferRegion = obdn_RequestBufferRegion(
+        memory, tableSize + baseAlign,
+        VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
+
+    const VkBufferDeviceAddressInfo addrInfo = {
+        .sType  = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .buffer = sbt->bufferRegion.buffer};
+    const VkDeviceAddress regionAddr =
+        vkGetBufferDeviceAddress(device, &addrInfo) + sbt->bufferRegion.offset;
+    const VkDeviceAddress base = alignUp(regionAddr, baseAlign);
+    uint8_t* dst = sbt->bufferRegion.hostData + (base - regionAddr);
+
+    const uint8_t* src = handles;
+    for (uint32_t i = 0; i < info->raygenCount; i++, src += handleSize)
+        memcpy(dst + raygenSize * i, src, handleSize);
+    uint8_t* missDst = dst + raygenSize * info->raygenCount;
+    for (uint32_t i = 0; i < info->missCount; i++, src += handleSize)
+        memcpy(missDst + stride * i, src, handleSize);
+    uint8_t* hitDst = missDst + missSize;
+    for (uint32_t i = 0; i < info->chitCount; i++, src += handleSize)
+        memcpy(hitDst + stride * i, src, handleSize);
+
+    hell_Free(handles);
+
+    sbt->raygenTable   = (VkStridedDeviceAddressRegionKHR){
+        .deviceAddress = base, .stride = raygenSize, .size = raygenSize};
+    sbt->missTable     = (VkStridedDeviceAddressRegionKHR){
+        .deviceAddress = base + raygenSize * info->raygenCount,
+        .stride        = stride,
+        .size          = missSize};
+    sbt->hitTable      = (VkStridedDeviceAddressRegionKHR){
+        .deviceAddress = base + raygenSize * info->raygenCount + missSize,
+        .stride        = stride,
+        .size          = hitSize};
+    sbt->callableTable = (VkStridedDeviceAddressRegionKHR){0};
+}
+
+void
+dali_CreateRayTracePipelines(const Obdn_Instance* instance, Obdn_Memory* memory,
+                             VkPipelineCache cache, const uint32_t count,
+                             const Obdn_RayTracePipelineInfo* infos,
+                             VkPipeline*                      pipelines,
+                             Obdn_R_ShaderBindingTable*       sbts)
+{
+    const VkDevice device = obdn_GetDevice(instance);
+    for (uint32_t p = 0; p < count; p++)
+    {
+        const Obdn_RayTracePipelineInfo* info = &infos[p];
+        const uint32_t                   stageCount =
+            info->raygenCount + info->missCount + info->chitCount;
+
+        VkPipelineShaderStageCreateInfo      stages[stageCount];
+        VkRayTracingShaderGroupCreateInfoKHR groups[stageCount];
+
+        // one group per shader, in the order the tables are laid out
+        uint32_t s = 0;
+        for (uint32_t i = 0; i < info->raygenCount; i++, s++)
+            stages[s] = shaderStage(device, info->raygenShaders[i],
+                                    VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        for (uint32_t i = 0; i < info->missCount; i++, s++)
+            stages[s] = shaderStage(device, info->missShaders[i],
+                                    VK_SHADER_STAGE_MISS_BIT_KHR);
+        for (uint32_t i = 0; i < info->chitCount; i++, s++)
+            stages[s] = shaderStage(device, info->chitShaders[i],
+                                    VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
+
+        for (uint32_t i = 0; i < stageCount; i++)
+        {
+            const bool hit = i >= info->raygenCount + info->missCount;
+            groups[i]      = (VkRayTracingShaderGroupCreateInfoKHR){
+                .sType =
+                    VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+                .type  = hit ? VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR
+                             : VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR,
+                .generalShader      = hit ? VK_SHADER_UNUSED_KHR : i,
+                .closestHitShader   = hit ? i : VK_SHADER_UNUSED_KHR,
+                .anyHitShader       = VK_SHADER_UNUSED_KHR,
+                .intersectionShader = VK_SHADER_UNUSED_KHR};
+        }
+
+        const VkRayTracingPipelineCreateInfoKHR createInfo = {
+            .sType      = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR,
+            .stageCount = stageCount,
+            .pStages    = stages,
+            .groupCount = stageCount,
+            .pGroups    = groups,
+            .maxPipelineRayRecursionDepth = 1,
+            .layout                       = info->layout,
+            .basePipelineIndex            = -1};
+
+        V_ASSERT(vkCreateRayTracingPipelinesKHR(device, VK_NULL_HANDLE, cache,
+                                                1, &createInfo, NULL,
+                                                &pipelines[p]));
+
+        for (uint32_t i = 0; i < stageCount; i++)
+            vkDestroyShaderModule(device, stages[i].module, NULL);
+
+        createShaderBindingTable(instance, memory, pipelines[p], info,
+                                 &sbts[p]);
+    }
+}
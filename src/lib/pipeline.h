@@ -0,0 +1,36 @@
+#ifndef DALI_PIPELINE_H
+#define DALI_PIPELINE_H
+
+#include <obsidian/pipeline.h>
+#include <obsidian/raytrace.h>
+
+// the engine's pipelines are built through a VkPipelineCache that persists
+// across runs in the user's cache directory ($XDG_CACHE_HOME or ~/.cache on
+// UNIX, %LOCALAPPDATA% on Windows; elsewhere the cache lasts one run). the
+// file is keyed by the device's pipeline cache UUID and driver version, so a
+// driver update or a different GPU starts from an empty cache instead of
+// feeding the driver stale data.
+
+// returns an empty cache if there is no file for this device yet or it could
+// not be read
+VkPipelineCache dali_LoadPipelineCache(const Obdn_Instance* instance);
+// writes the cache back unless the file already holds the same data
+void dali_SavePipelineCache(const Obdn_Instance* instance, VkPipelineCache cache);
+void dali_DestroyPipelineCache(const Obdn_Instance* instance, VkPipelineCache cache);
+
+// the same as obsidian's pipeline helpers, but through cache
+void dali_CreateGraphicsPipelines(VkDevice device, VkPipelineCache cache,
+                                  const uint32_t count,
+                                  const Obdn_GraphicsPipelineInfo* infos,
+                                  VkPipeline* pipelines);
+void dali_CreateComputePipeline(VkDevice device, VkPipelineCache cache,
+                                VkPipelineLayout layout, const char* shader,
+                                VkPipeline* pipeline);
+void dali_CreateRayTracePipelines(const Obdn_Instance* instance,
+                                  Obdn_Memory* memory, VkPipelineCache cache,
+                                  const uint32_t count,
+                                  const Obdn_RayTracePipelineInfo* infos,
+                                  VkPipeline* pipelines,
+                                  Obdn_R_ShaderBindingTable* sbts);
+
+#endif /* end of include guard: DALI_PIPELINE_H */
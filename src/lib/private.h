@@ -4,7 +4,11 @@
 #include <obsidian/def.h>
 #include <obsidian/video.h>
 #include "obsidian/memory.h"
-#define MAX_LAYERS 64
+#include "layer.h"
+#include "tilepool.h"
+
+#define DALI_TILE_SIZE  256 // texels along one side of a layer tile
+#define DALI_TEXEL_SIZE 4   // bytes per texel, layers are R8G8B8A8
 
 typedef uint32_t DirtMask;
 
@@ -16,30 +20,54 @@ typedef enum {
 typedef enum {
     LAYER_BACKUP_BIT  = (DirtMask)1 << 4,
     LAYER_CHANGED_BIT = (DirtMask)1 << 5,
+    // only how the layers are composited changed, not what is on them
+    LAYER_COMPOSITE_BIT = (DirtMask)1 << 7,
 } LayerStackDirtyBits;
 
 typedef enum {
     UNDO_BIT          = (DirtMask)1 << 3,
+    REDO_BIT          = (DirtMask)1 << 6,
 } UndoDirtyBits;
 
+// a layer is a sparse grid of tiles. a tile that has never been written has
+// no backing memory (size 0) and reads as the stack's shared empty tile.
 typedef struct Dali_Layer {
-    Obdn_V_BufferRegion bufferRegion;
+    Obdn_V_BufferRegion* tiles;
+    uint8_t*             occupancy; // a Dali_TileOccupancy per tile
+    float                opacity;
+    Dali_BlendMode       blendMode;
+    bool                 visible;
+    // the host tiles were written by something other than the engine, so its
+    // device copy of the layer is out of date
+    bool                 written;
+    // bumped whenever its contents change, so that what was composited from
+    // them can be told apart from what they are now
+    uint32_t             version;
+    // bumped by dali_StoreLayer only, so a recording can tell the contents
+    // the app gave the layer from what was painted
+    uint32_t             storeCount;
 } Dali_Layer;
 
 typedef struct Dali_LayerStack{
     uint16_t     layerCount;
+    uint16_t     layerCapacity;
     uint16_t     activeLayer;
-    VkDeviceSize layerSize;
-    Dali_Layer    layers[MAX_LAYERS];
-    Obdn_V_BufferRegion backBuffer;
-    Obdn_V_BufferRegion frontBuffer;
-    Obdn_Memory*        memory;
+    uint32_t     textureSize;  // texels along one side of a layer
+    uint32_t     tilesPerSide;
+    uint32_t     tileCount;
+    VkDeviceSize tileSize;     // bytes
+    VkDeviceSize layerSize;    // bytes, if every tile were backed
+    Dali_Layer*  layers;
+    Dali_LayerId*  order;        // layer ids from the bottom of the stack up
+    Obdn_V_BufferRegion emptyTile;
+    Dali_TilePool       tilePool; // the layers' tiles and the undo history's
     DirtMask       dirt;
 } Dali_LayerStack;
 
 typedef enum {
     PAINT_MODE_OVER,
-    PAINT_MODE_ERASE
+    PAINT_MODE_ERASE,
+    PAINT_MODE_COUNT
 } PaintMode;
 
 typedef struct Dali_Brush {
@@ -52,35 +80,55 @@ typedef struct Dali_Brush {
     bool          active;
     float         opacity;
     float         falloff;
+    float         quality; // rays per texel along each axis of a dab
     PaintMode     mode;
     DirtMask      dirt;
 } Dali_Brush;
 
-#define MAX_UNDOS 8
-#define MAX_STACKS 4
-
 typedef uint16_t Dali_LayerId;
 
 typedef Obdn_V_BufferRegion BufferRegion;
 typedef Dali_LayerId L_LayerId;
 
-_Static_assert(MAX_UNDOS % 2 == 0, "MAX_UNDOS must be a multiple of 2 for bottom wrap around to work");
-
-typedef struct UndoStack {
-    uint8_t              trl; // cur cannot cross this
-    uint8_t              cur;
-    Obdn_V_BufferRegion  bufferRegions[MAX_UNDOS];
-} UndoStack;
+// a tile's contents from before the stroke that modified it. a tile that was
+// empty has a region of size 0.
+typedef struct UndoTile {
+    uint32_t            index;
+    bool                empty;
+    Obdn_V_BufferRegion region;
+} UndoTile;
+
+// the tiles a single stroke modified. once spilled, the regions are freed and
+// the non-empty tiles are packed in order at spillOffset in the spill file.
+typedef struct Dali_UndoEntry {
+    L_LayerId    layer;
+    bool         spilled;
+    VkDeviceSize size; // bytes of tile data
+    VkDeviceSize spillOffset;
+    uint32_t     tileCount;
+    uint32_t     tileCapacity;
+    UndoTile*    tiles;
+} Dali_UndoEntry;
 
 typedef struct Dali_UndoManager { 
-    uint8_t   maxStacks;
-    uint8_t   maxUndos;
-    
-    uint8_t   curStackIndex;
-    uint8_t   stackNotUsedCounters[MAX_STACKS];
-    L_LayerId layerCache[MAX_STACKS];
-    UndoStack undoStacks[MAX_STACKS];
-    DirtMask  dirt;
+    Dali_TilePool*  tilePool; // the stack's
+    VkDeviceSize    memoryBudget;
+    VkDeviceSize    residentSize; // bytes of tile data held in host memory,
+                                  // including redo entries
+    VkDeviceSize    tileSize;
+    uint32_t        entryCount;
+    uint32_t        entryCapacity;
+    uint32_t        spilledCount; // the oldest entries are the spilled ones
+    Dali_UndoEntry* entries;      // oldest first
+    uint32_t        redoCount;
+    uint32_t        redoCapacity;
+    Dali_UndoEntry* redoEntries;  // most recently undone last
+    bool            recording;
+    // optional ring buffer in a mapped file for entries over the budget
+    uint8_t*        spillData;
+    VkDeviceSize    spillSize;
+    VkDeviceSize    spillTail;
+    DirtMask        dirt;
 } Dali_UndoManager;
 
 #endif /* end of include guard: PRIVATE_H */
@@ -0,0 +1,184 @@
+#include "profiler.h"
+#include <hell/common.h>
+#include <hell/debug.h>
+#include <obsidian/video.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a begin and an end timestamp per span
+#define QUERIES_PER_SLOT (2 * DALI_PROFILER_SPANS)
+
+static const char* stageNames[DALI_STAGE_COUNT] = {
+    [DALI_STAGE_SPLAT]        = "splat",
+    [DALI_STAGE_APPLY]        = "apply",
+    [DALI_STAGE_CLEAR_STAMP]  = "clearstamp",
+    [DALI_STAGE_COMPOSITE]    = "comp",
+    [DALI_STAGE_LAYER_CHANGE] = "layerchange",
+    [DALI_STAGE_RESTORE]      = "restore",
+    [DALI_STAGE_BACKUP]       = "backup",
+    [DALI_STAGE_PRIM]         = "prim",
+};
+
+void
+dali_CreateProfiler(const Obdn_Instance* instance, const uint32_t slotCount,
+                    Dali_Profiler* profiler)
+{
+    memset(profiler, 0, sizeof(*profiler));
+    profiler->device    = obdn_GetDevice(instance);
+    profiler->slotCount = slotCount;
+    profiler->slots     = calloc(slotCount, sizeof(Dali_ProfilerSlot));
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(obdn_GetPhysicalDevice(instance), &props);
+    profiler->supported = props.limits.timestampComputeAndGraphics;
+    profiler->msPerTick = props.limits.timestampPeriod / 1000000.0;
+    if (!profiler->supported)
+    {
+        hell_DPrint("Device has no timestamps, only host timed stages will "
+                    "be profiled\n");
+        return;
+    }
+
+    const VkQueryPoolCreateInfo info = {
+        .sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType  = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = QUERIES_PER_SLOT};
+
+    for (uint32_t i = 0; i < slotCount; i++)
+        V_ASSERT(vkCreateQueryPool(profiler->device, &info, NULL,
+                                   &profiler->slots[i].pool));
+}
+
+void
+dali_DestroyProfiler(Dali_Profiler* profiler)
+{
+    for (uint32_t i = 0; i < profiler->slotCount; i++)
+        vkDestroyQueryPool(profiler->device, profiler->slots[i].pool, NULL);
+    free(profiler->slots);
+    memset(profiler, 0, sizeof(*profiler));
+}
+
+void
+dali_CmdBeginStage(Dali_Profiler* profiler, const uint32_t slot,
+                   VkCommandBuffer cmdBuf, const Dali_Stage stage)
+{
+    if (!profiler->supported)
+        return;
+    Dali_ProfilerSlot* s = &profiler->slots[slot];
+    if (s->spanCount == DALI_PROFILER_SPANS)
+        return; // dropped
+    if (!s->reset)
+    {
+        vkCmdResetQueryPool(cmdBuf, s->pool, 0, QUERIES_PER_SLOT);
+        s->reset = true;
+    }
+    // bottom of pipe on both ends, so a stage's span starts once everything
+    // recorded before it is done rather than overlapping it
+    vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, s->pool,
+                        2 * s->spanCount);
+    s->stages[s->spanCount++] = stage;
+    s->open                   = true;
+}
+
+void
+dali_CmdEndStage(Dali_Profiler* profiler, const uint32_t slot,
+                 VkCommandBuffer cmdBuf, const Dali_Stage stage)
+{
+    if (!profiler->supported)
+        return;
+    Dali_ProfilerSlot* s = &profiler->slots[slot];
+    if (!s->open)
+        return; // its begin was dropped
+    assert(s->stages[s->spanCount - 1] == stage);
+    vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, s->pool,
+                        2 * s->spanCount - 1);
+    s->open = false;
+}
+
+void
+dali_CollectProfilerSlot(Dali_Profiler* profiler, const uint32_t slot)
+{
+    Dali_ProfilerSlot* s = &profiler->slots[slot];
+    if (s->spanCount > 0)
+    {
+        // a value and its availability per query. we never wait: a span the
+        // device did not finish is dropped.
+        uint64_t results[QUERIES_PER_SLOT][2];
+        vkGetQueryPoolResults(profiler->device, s->pool, 0, 2 * s->spanCount,
+                              sizeof(results), results, sizeof(results[0]),
+                              VK_QUERY_RESULT_64_BIT |
+                                  VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        for (uint32_t i = 0; i < s->spanCount; i++)
+        {
+            const uint64_t* begin = results[2 * i];
+            const uint64_t* end   = results[2 * i + 1];
+            if (!begin[1] || !end[1] || end[0] < begin[0])
+                continue;
+            dali_AddStageSample(profiler, s->stages[i],
+                                (end[0] - begin[0]) * profiler->msPerTick);
+        }
+    }
+    s->spanCount = 0;
+    s->reset     = false;
+    s->open      = false;
+}
+
+void
+dali_ClearRecentSamples(Dali_Profiler* profiler)
+{
+    memset(profiler->recentMs, 0, sizeof(profiler->recentMs));
+}
+
+void
+dali_AddStageSample(Dali_Profiler* profiler, const Dali_Stage stage,
+                    const float ms)
+{
+    profiler->recentMs[stage] += ms;
+    Dali_StageSamples* samples = &profiler->stages[stage];
+    samples->ms[samples->next] = ms;
+    samples->next              = (samples->next + 1) % DALI_PROFILER_WINDOW;
+    if (samples->count < DALI_PROFILER_WINDOW)
+        samples->count++;
+}
+
+static int
+compareMs(const void* a, const void* b)
+{
+    const float x = *(const float*)a;
+    const float y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+void
+dali_GetProfilerTiming(const Dali_Profiler* profiler, const Dali_Stage stage,
+                       Dali_StageTiming* timing)
+{
+    memset(timing, 0, sizeof(*timing));
+    const Dali_StageSamples* samples = &profiler->stages[stage];
+    const uint32_t           n       = samples->count;
+    if (n == 0)
+        return;
+
+    float sorted[DALI_PROFILER_WINDOW];
+    memcpy(sorted, samples->ms, n * sizeof(float));
+    qsort(sorted, n, sizeof(float), compareMs);
+
+    float sum = 0;
+    for (uint32_t i = 0; i < n; i++)
+        sum += sorted[i];
+
+    // the smallest sample at or above 99% of them
+    const uint32_t p99 = (99 * n + 99) / 100 - 1;
+
+    timing->samples = n;
+    timing->min     = sorted[0];
+    timing->avg     = sum / n;
+    timing->p99     = sorted[p99];
+}
+
+const char*
+dali_GetStageName(const Dali_Stage stage)
+{
+    return stageNames[stage];
+}
@@ -0,0 +1,65 @@
+#ifndef DALI_PROFILER_H
+#define DALI_PROFILER_H
+
+#include "engine.h"
+#include <obsidian/video.h>
+
+// times the engine's stages with gpu timestamps. each command buffer the
+// engine records into gets a slot with its own query pool. a slot's timestamps
+// are read back once the commands it was last recorded into have completed,
+// and each stage keeps a rolling window of what they measured, along with the
+// total of what was read back since the profiler was last cleared.
+
+#define DALI_PROFILER_WINDOW 128 // samples each stage's timings cover
+#define DALI_PROFILER_SPANS  16  // stages one slot can time before it is read
+
+typedef struct Dali_ProfilerSlot {
+    VkQueryPool pool;
+    bool        reset; // since it was last read
+    bool        open;  // its last span has yet to be ended
+    uint32_t    spanCount;
+    Dali_Stage  stages[DALI_PROFILER_SPANS];
+} Dali_ProfilerSlot;
+
+typedef struct Dali_StageSamples {
+    float    ms[DALI_PROFILER_WINDOW];
+    uint32_t count;
+    uint32_t next;
+} Dali_StageSamples;
+
+typedef struct Dali_Profiler {
+    uint32_t           slotCount;
+    Dali_ProfilerSlot* slots;
+    Dali_StageSamples  stages[DALI_STAGE_COUNT];
+    float              recentMs[DALI_STAGE_COUNT]; // since the last clear
+    float              msPerTick;
+    bool               supported; // whether the device writes timestamps at all
+    VkDevice           device;
+} Dali_Profiler;
+
+void dali_CreateProfiler(const Obdn_Instance* instance, const uint32_t slotCount,
+                         Dali_Profiler* profiler);
+void dali_DestroyProfiler(Dali_Profiler* profiler);
+
+// brackets what is recorded in between with timestamps. must be recorded
+// outside of a render pass if it is the first stage since the slot was read.
+void dali_CmdBeginStage(Dali_Profiler* profiler, const uint32_t slot,
+                        VkCommandBuffer cmdBuf, const Dali_Stage stage);
+void dali_CmdEndStage(Dali_Profiler* profiler, const uint32_t slot,
+                      VkCommandBuffer cmdBuf, const Dali_Stage stage);
+
+// reads back the slot's timestamps. the commands they were recorded into must
+// have been submitted and completed.
+void dali_CollectProfilerSlot(Dali_Profiler* profiler, const uint32_t slot);
+
+// zeroes recentMs, typically before the slots of a frame are read back
+void dali_ClearRecentSamples(Dali_Profiler* profiler);
+
+// for stages that block the host until the device is done with them anyway
+void dali_AddStageSample(Dali_Profiler* profiler, const Dali_Stage stage,
+                         const float ms);
+
+void dali_GetProfilerTiming(const Dali_Profiler* profiler,
+                            const Dali_Stage stage, Dali_StageTiming* timing);
+
+#endif /* end of include guard: DALI_PROFILER_H */
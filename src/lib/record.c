@@ -0,0 +1,613 @@
+#include "record.h"
+#include "dtags.h"
+#include "private.h"
+#include <hell/common.h>
+#include <hell/debug.h>
+#include <hell/len.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAGIC   "DALIREC"
+#define VERSION 3
+
+// the file is little-endian and unpadded whatever the host, so every field
+// is written and read on its own at a fixed width. floats are written as
+// their IEEE 754 bits.
+
+// what follows a frame's header
+enum {
+    // 9 floats: x, y, radius, r, g, b, opacity, falloff, quality, then the
+    // mode and whether it is active as uint32s
+    SECTION_BRUSH  = 1 << 0,
+    // a row major matrix of 16 floats
+    SECTION_VIEW   = 1 << 1,
+    SECTION_PROJ   = 1 << 2,
+    // each layer's opacity as a float, blend mode and visibility as uint32s,
+    // then the stack's order as uint16 ids
+    SECTION_LAYERS = 1 << 3,
+    // a uint16 count of stored layers, then each one's uint16 id and tiles
+    SECTION_STORES = 1 << 4,
+};
+
+// the magic's 8 bytes, then the fields in order
+typedef struct FileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t textureSize;
+    uint64_t seed;
+} FileHeader;
+
+// written in this order, the time as a double
+typedef struct FrameHeader {
+    double       time; // ms since the recording began
+    uint32_t     sections;
+    DirtMask     brushDirt;
+    DirtMask     stackDirt;
+    DirtMask     undoDirt;
+    Dali_LayerId activeLayer;
+    uint16_t     layerCount;
+} FrameHeader;
+
+typedef struct Dali_Recorder {
+    FILE*     file;
+    double    start;
+    uint32_t  frameCount;
+    uint32_t* storeCounts; // by layer id, as of the last recorded store
+    uint16_t  layerCount;  // storeCounts has room for this many
+} Dali_Recorder;
+
+typedef struct Dali_Replay {
+    FILE*      file;
+    FileHeader header;
+} Dali_Replay;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void
+writeLE(FILE* file, const uint64_t v, const int size)
+{
+    uint8_t bytes[8];
+    for (int i = 0; i < size; i++)
+        bytes[i] = (uint8_t)(v >> 8 * i);
+    fwrite(bytes, size, 1, file);
+}
+
+static bool
+readLE(FILE* file, uint64_t* v, const int size)
+{
+    uint8_t bytes[8];
+    if (fread(bytes, size, 1, file) != 1)
+        return false;
+    *v = 0;
+    for (int i = 0; i < size; i++)
+        *v |= (uint64_t)bytes[i] << 8 * i;
+    return true;
+}
+
+static void
+writeU8(FILE* file, const uint8_t v)
+{
+    writeLE(file, v, 1);
+}
+
+static void
+writeU16(FILE* file, const uint16_t v)
+{
+    writeLE(file, v, 2);
+}
+
+static void
+writeU32(FILE* file, const uint32_t v)
+{
+    writeLE(file, v, 4);
+}
+
+static void
+writeU64(FILE* file, const uint64_t v)
+{
+    writeLE(file, v, 8);
+}
+
+static void
+writeF32(FILE* file, const float v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    writeU32(file, bits);
+}
+
+static void
+writeF64(FILE* file, const double v)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    writeU64(file, bits);
+}
+
+static void
+writeMat4(FILE* file, const Coal_Mat4* m)
+{
+    _Static_assert(sizeof(Coal_Mat4) == 16 * sizeof(float),
+                   "a matrix is 16 floats");
+    float e[16];
+    memcpy(e, m, sizeof(e));
+    for (int i = 0; i < 16; i++)
+        writeF32(file, e[i]);
+}
+
+static bool
+readU8(FILE* file, uint8_t* v)
+{
+    uint64_t u;
+    if (!readLE(file, &u, 1))
+        return false;
+    *v = (uint8_t)u;
+    return true;
+}
+
+static bool
+readU16(FILE* file, uint16_t* v)
+{
+    uint64_t u;
+    if (!readLE(file, &u, 2))
+        return false;
+    *v = (uint16_t)u;
+    return true;
+}
+
+static bool
+readU32(FILE* file, uint32_t* v)
+{
+    uint64_t u;
+    if (!readLE(file, &u, 4))
+        return false;
+    *v = (uint32_t)u;
+    return true;
+}
+
+static bool
+readU64(FILE* file, uint64_t* v)
+{
+    return readLE(file, v, 8);
+}
+
+static bool
+readF32(FILE* file, float* v)
+{
+    uint32_t bits;
+    if (!readU32(file, &bits))
+        return false;
+    memcpy(v, &bits, sizeof(*v));
+    return true;
+}
+
+static bool
+readF64(FILE* file, double* v)
+{
+    uint64_t bits;
+    if (!readU64(file, &bits))
+        return false;
+    memcpy(v, &bits, sizeof(*v));
+    return true;
+}
+
+static bool
+readMat4(FILE* file, Coal_Mat4* m)
+{
+    float e[16];
+    for (int i = 0; i < 16; i++)
+    {
+        if (!readF32(file, &e[i]))
+            return false;
+    }
+    memcpy(m, e, sizeof(e));
+    return true;
+}
+
+static void
+writeFileHeader(FILE* file, const FileHeader* header)
+{
+    fwrite(header->magic, sizeof(header->magic), 1, file);
+    writeU32(file, header->version);
+    writeU32(file, header->textureSize);
+    writeU64(file, header->seed);
+}
+
+static bool
+readFileHeader(FILE* file, FileHeader* header)
+{
+    return fread(header->magic, sizeof(header->magic), 1, file) == 1 &&
+           readU32(file, &header->version) &&
+           readU32(file, &header->textureSize) && readU64(file, &header->seed);
+}
+
+static void
+writeFrameHeader(FILE* file, const FrameHeader* frame)
+{
+    writeF64(file, frame->time);
+    writeU32(file, frame->sections);
+    writeU32(file, frame->brushDirt);
+    writeU32(file, frame->stackDirt);
+    writeU32(file, frame->undoDirt);
+    writeU16(file, frame->activeLayer);
+    writeU16(file, frame->layerCount);
+}
+
+static bool
+readFrameHeader(FILE* file, FrameHeader* frame)
+{
+    return readF64(file, &frame->time) && readU32(file, &frame->sections) &&
+           readU32(file, &frame->brushDirt) &&
+           readU32(file, &frame->stackDirt) &&
+           readU32(file, &frame->undoDirt) &&
+           readU16(file, &frame->activeLayer) &&
+           readU16(file, &frame->layerCount);
+}
+
+static void
+writeBrush(FILE* file, const Dali_Brush* brush)
+{
+    writeF32(file, brush->x);
+    writeF32(file, brush->y);
+    writeF32(file, brush->radius);
+    writeF32(file, brush->r);
+    writeF32(file, brush->g);
+    writeF32(file, brush->b);
+    writeF32(file, brush->opacity);
+    writeF32(file, brush->falloff);
+    writeF32(file, brush->quality);
+    writeU32(file, brush->mode);
+    writeU32(file, brush->active);
+}
+
+// the brush is only changed once all of it has been read
+static bool
+readBrush(FILE* file, Dali_Brush* brush)
+{
+    float    f[9];
+    uint32_t mode, active;
+    for (int i = 0; i < LEN(f); i++)
+    {
+        if (!readF32(file, &f[i]))
+            return false;
+    }
+    if (!readU32(file, &mode) || !readU32(file, &active))
+        return false;
+    brush->x       = f[0];
+    brush->y       = f[1];
+    brush->radius  = f[2];
+    brush->r       = f[3];
+    brush->g       = f[4];
+    brush->b       = f[5];
+    brush->opacity = f[6];
+    brush->falloff = f[7];
+    brush->quality = f[8];
+    brush->mode    = mode;
+    brush->active  = active;
+    return true;
+}
+
+Dali_Recorder*
+dali_AllocRecorder(void)
+{
+    return hell_Malloc(sizeof(Dali_Recorder));
+}
+
+bool
+dali_CreateRecorder(const char* path, const uint64_t seed,
+                    const Dali_LayerStack* stack, Dali_Recorder* recorder)
+{
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->file = fopen(path, "wb");
+    if (!recorder->file)
+    {
+        hell_DPrint("Could not open %s for recording\n", path);
+        return false;
+    }
+    FileHeader header = {.version     = VERSION,
+                         .textureSize = stack->textureSize,
+                         .seed        = seed};
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    writeFileHeader(recorder->file, &header);
+    recorder->start = now();
+    return true;
+}
+
+static bool
+layerIsEmpty(const Dali_LayerStack* stack, const Dali_LayerId id)
+{
+    for (uint32_t t = 0; t < stack->tileCount; t++)
+    {
+        if (!dali_LayerTileIsEmpty(stack, id, t))
+            return false;
+    }
+    return true;
+}
+
+// whether the layer's contents came from the app since the last frame. on the
+// first frame that is any content at all.
+static bool
+layerWasStored(const Dali_Recorder* recorder, const Dali_LayerStack* stack,
+               const Dali_LayerId id)
+{
+    if (recorder->frameCount == 0)
+        return !layerIsEmpty(stack, id);
+    const uint32_t seen =
+        id < recorder->layerCount ? recorder->storeCounts[id] : 0;
+    return stack->layers[id].storeCount != seen;
+}
+
+static void
+writeLayers(const Dali_LayerStack* stack, FILE* file)
+{
+    for (uint16_t l = 0; l < stack->layerCount; l++)
+    {
+        const Dali_Layer* layer = &stack->layers[l];
+        writeF32(file, layer->opacity);
+        writeU32(file, layer->blendMode);
+        writeU32(file, layer->visible);
+    }
+    for (uint16_t i = 0; i < stack->layerCount; i++)
+        writeU16(file, stack->order[i]);
+}
+
+// a tile is a byte saying whether it is backed, followed by its texels if so
+static void
+writeStores(Dali_Recorder* recorder, const Dali_LayerStack* stack,
+            const uint16_t storeCount)
+{
+    writeU16(recorder->file, storeCount);
+    for (Dali_LayerId l = 0; l < stack->layerCount; l++)
+    {
+        if (!layerWasStored(recorder, stack, l))
+            continue;
+        writeU16(recorder->file, l);
+        const Dali_Layer* layer = &stack->layers[l];
+        for (uint32_t t = 0; t < stack->tileCount; t++)
+        {
+            const uint8_t backed = layer->tiles[t].size > 0;
+            writeU8(recorder->file, backed);
+            if (backed)
+                fwrite(layer->tiles[t].hostData, stack->tileSize, 1,
+                       recorder->file);
+        }
+    }
+}
+
+void
+dali_RecordFrame(Dali_Recorder* recorder, const Obdn_Scene* scene,
+                 const Dali_Brush* brush, const Dali_LayerStack* stack,
+                 const Dali_UndoManager* undo)
+{
+    const Obdn_SceneDirtyFlags sceneDirt = obdn_GetSceneDirt(scene);
+    const bool                 first     = recorder->frameCount == 0;
+
+    FrameHeader frame = {.time        = now() - recorder->start,
+                         .brushDirt   = brush->dirt,
+                         .stackDirt   = stack->dirt,
+                         .undoDirt    = undo->dirt,
+                         .activeLayer = stack->activeLayer,
+                         .layerCount  = stack->layerCount};
+    // the first frame carries everything, after that only what changed
+    if (first || brush->dirt)
+        frame.sections |= SECTION_BRUSH;
+    if (first || (sceneDirt & OBDN_SCENE_CAMERA_VIEW_BIT))
+        frame.sections |= SECTION_VIEW;
+    if (first || (sceneDirt & OBDN_SCENE_CAMERA_PROJ_BIT))
+        frame.sections |= SECTION_PROJ;
+    if (first || (stack->dirt & LAYER_COMPOSITE_BIT))
+        frame.sections |= SECTION_LAYERS;
+    uint16_t storeCount = 0;
+    for (Dali_LayerId l = 0; l < stack->layerCount; l++)
+        storeCount += layerWasStored(recorder, stack, l);
+    if (storeCount)
+        frame.sections |= SECTION_STORES;
+    writeFrameHeader(recorder->file, &frame);
+
+    if (frame.sections & SECTION_BRUSH)
+        writeBrush(recorder->file, brush);
+    if (frame.sections & SECTION_VIEW)
+    {
+        const Coal_Mat4 view = obdn_GetCameraView(scene);
+        writeMat4(recorder->file, &view);
+    }
+    if (frame.sections & SECTION_PROJ)
+    {
+        const Coal_Mat4 proj = obdn_GetCameraProjection(scene);
+        writeMat4(recorder->file, &proj);
+    }
+    if (frame.sections & SECTION_LAYERS)
+        writeLayers(stack, recorder->file);
+    if (frame.sections & SECTION_STORES)
+        writeStores(recorder, stack, storeCount);
+
+    if (recorder->layerCount < stack->layerCount)
+    {
+        recorder->storeCounts = realloc(recorder->storeCounts,
+                                        sizeof(uint32_t) * stack->layerCount);
+        assert(recorder->storeCounts);
+        recorder->layerCount = stack->layerCount;
+    }
+    for (uint16_t l = 0; l < stack->layerCount; l++)
+        recorder->storeCounts[l] = stack->layers[l].storeCount;
+
+    // so a crash keeps the session that led up to it
+    fflush(recorder->file);
+    recorder->frameCount++;
+}
+
+void
+dali_DestroyRecorder(Dali_Recorder* recorder)
+{
+    if (recorder->file)
+        fclose(recorder->file);
+    free(recorder->storeCounts);
+    hell_DebugPrint(PAINT_DEBUG_TAG_PAINT, "recorded %d frames\n",
+                    recorder->frameCount);
+    memset(recorder, 0, sizeof(*recorder));
+}
+
+Dali_Replay*
+dali_AllocReplay(void)
+{
+    return hell_Malloc(sizeof(Dali_Replay));
+}
+
+bool
+dali_CreateReplay(const char* path, Dali_Replay* replay)
+{
+    memset(replay, 0, sizeof(*replay));
+    replay->file = fopen(path, "rb");
+    if (!replay->file)
+    {
+        hell_DPrint("Could not open %s for replay\n", path);
+        return false;
+    }
+    if (!readFileHeader(replay->file, &replay->header) ||
+        memcmp(replay->header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        replay->header.version != VERSION)
+    {
+        hell_DPrint("%s is not a recording this version can replay\n", path);
+        fclose(replay->file);
+        replay->file = NULL;
+        return false;
+    }
+    return true;
+}
+
+uint32_t
+dali_GetReplayTextureSize(const Dali_Replay* replay)
+{
+    return replay->header.textureSize;
+}
+
+uint64_t
+dali_GetReplaySeed(const Dali_Replay* replay)
+{
+    return replay->header.seed;
+}
+
+static bool
+readLayers(Dali_LayerStack* stack, FILE* file)
+{
+    for (uint16_t l = 0; l < stack->layerCount; l++)
+    {
+        float    opacity;
+        uint32_t blendMode, visible;
+        if (!readF32(file, &opacity) || !readU32(file, &blendMode) ||
+            !readU32(file, &visible))
+            return false;
+        Dali_Layer* layer = &stack->layers[l];
+        layer->opacity    = opacity;
+        layer->blendMode  = blendMode;
+        layer->visible    = visible;
+    }
+    for (uint16_t i = 0; i < stack->layerCount; i++)
+    {
+        if (!readU16(file, &stack->order[i]))
+            return false;
+    }
+    return true;
+}
+
+// each stored layer is put back together and stored again, so it is trimmed
+// and scanned as it was when recorded
+static bool
+readStores(Dali_LayerStack* stack, FILE* file)
+{
+    uint16_t storeCount;
+    if (!readU16(file, &storeCount))
+        return false;
+    const size_t rowSize   = DALI_TILE_SIZE * DALI_TEXEL_SIZE;
+    const size_t rowStride = stack->textureSize * DALI_TEXEL_SIZE;
+    uint8_t*     data      = malloc(stack->layerSize);
+    uint8_t*     tile      = malloc(stack->tileSize);
+    assert(data && tile);
+    bool ok = true;
+    for (uint16_t s = 0; s < storeCount && ok; s++)
+    {
+        Dali_LayerId id;
+        ok = readU16(file, &id) && id < stack->layerCount;
+        for (uint32_t t = 0; t < stack->tileCount && ok; t++)
+        {
+            uint8_t backed;
+            ok = readU8(file, &backed);
+            if (ok && backed)
+                ok = fread(tile, stack->tileSize, 1, file) == 1;
+            else
+                memset(tile, 0, stack->tileSize);
+            const uint32_t tx  = t % stack->tilesPerSide;
+            const uint32_t ty  = t / stack->tilesPerSide;
+            uint8_t*       dst = data + ty * DALI_TILE_SIZE * rowStride +
+                           tx * rowSize;
+            for (int row = 0; row < DALI_TILE_SIZE; row++)
+                memcpy(dst + row * rowStride, tile + row * rowSize, rowSize);
+        }
+        if (ok)
+            dali_StoreLayer(stack, id, data);
+    }
+    free(tile);
+    free(data);
+    return ok;
+}
+
+bool
+dali_ReplayFrame(Dali_Replay* replay, Obdn_Scene* scene, Dali_Brush* brush,
+                 Dali_LayerStack* stack, Dali_UndoManager* undo, double* time)
+{
+    FrameHeader frame;
+    if (!readFrameHeader(replay->file, &frame))
+        return false;
+
+    if ((frame.sections & SECTION_BRUSH) && !readBrush(replay->file, brush))
+        return false;
+    if (frame.sections & SECTION_VIEW)
+    {
+        Coal_Mat4 view;
+        if (!readMat4(replay->file, &view))
+            return false;
+        obdn_SetCameraView(scene, view);
+    }
+    if (frame.sections & SECTION_PROJ)
+    {
+        Coal_Mat4 proj;
+        if (!readMat4(replay->file, &proj))
+            return false;
+        obdn_SetCameraProjection(scene, proj);
+    }
+
+    while (stack->layerCount < frame.layerCount)
+        dali_CreateLayer(stack);
+    stack->activeLayer = frame.activeLayer;
+
+    if ((frame.sections & SECTION_LAYERS) && !readLayers(stack, replay->file))
+        return false;
+    if ((frame.sections & SECTION_STORES) && !readStores(stack, replay->file))
+        return false;
+
+    // the dirt is what tells dali_Paint which of the requests to act on
+    brush->dirt = frame.brushDirt;
+    stack->dirt = frame.stackDirt;
+    undo->dirt  = frame.undoDirt;
+
+    if (time)
+        *time = frame.time;
+    return true;
+}
+
+void
+dali_DestroyReplay(Dali_Replay* replay)
+{
+    if (replay->file)
+        fclose(replay->file);
+    memset(replay, 0, sizeof(*replay));
+}
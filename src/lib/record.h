@@ -0,0 +1,48 @@
+#ifndef DALI_RECORD_H
+#define DALI_RECORD_H
+
+#include "brush.h"
+#include "layer.h"
+#include "undo.h"
+#include <obsidian/scene.h>
+
+// a recording holds the state dali_Paint saw on each call: the brush, the
+// camera, the active layer and layer count, each layer's opacity, blend mode
+// and visibility, the order of the stack, the contents dali_StoreLayer gave
+// a layer, and which of them changed, along with the engine's seed. the
+// first frame carries whatever the layers held when it was recorded.
+// replaying it into a freshly created engine, stack and undo manager over
+// the same mesh paints the same texels, so a session can be reproduced
+// exactly and timed as fast as the device allows. the file reads the same
+// on any host. primitive changes are not recorded.
+
+typedef struct Dali_Recorder Dali_Recorder;
+typedef struct Dali_Replay   Dali_Replay;
+
+Dali_Recorder* dali_AllocRecorder(void);
+// must be created before the first dali_Paint, with the engine seeded with
+// seed. returns false if the file could not be opened.
+bool dali_CreateRecorder(const char* path, const uint64_t seed,
+                         const Dali_LayerStack* stack, Dali_Recorder* recorder);
+// call right before each dali_Paint
+void dali_RecordFrame(Dali_Recorder* recorder, const Obdn_Scene* scene,
+                      const Dali_Brush* brush, const Dali_LayerStack* stack,
+                      const Dali_UndoManager* undo);
+void dali_DestroyRecorder(Dali_Recorder* recorder);
+
+Dali_Replay* dali_AllocReplay(void);
+// returns false if the file could not be read or is not a recording
+bool     dali_CreateReplay(const char* path, Dali_Replay* replay);
+// the stack and engine have to be created with this size, and the engine
+// seeded with the seed
+uint32_t dali_GetReplayTextureSize(const Dali_Replay* replay);
+uint64_t dali_GetReplaySeed(const Dali_Replay* replay);
+// restores the state of the next recorded frame, to be painted with
+// dali_Paint. time is when it was recorded, in ms since the recording began.
+// returns false once every frame has been replayed.
+bool dali_ReplayFrame(Dali_Replay* replay, Obdn_Scene* scene,
+                      Dali_Brush* brush, Dali_LayerStack* stack,
+                      Dali_UndoManager* undo, double* time);
+void dali_DestroyReplay(Dali_Replay* replay);
+
+#endif /* end of include guard: DALI_RECORD_H */
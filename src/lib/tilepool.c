@@ -0,0 +1,145 @@
+#include "tilepool.h"
+#include <hell/common.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// tiles per chunk. a 4k layer is 256 tiles of 256 KiB, so this keeps the
+// region requests a stroke across it makes to a handful.
+#define CHUNK_TILES 32
+
+void
+dali_CreateTilePool(Obdn_Memory* memory, const VkDeviceSize tileSize,
+                    Dali_TilePool* pool)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->memory   = memory;
+    pool->tileSize = tileSize;
+}
+
+static void
+reserveFreeTiles(Dali_TilePool* pool, const uint32_t count)
+{
+    if (count <= pool->freeCapacity)
+        return;
+    while (pool->freeCapacity < count)
+        pool->freeCapacity = pool->freeCapacity ? pool->freeCapacity * 2
+                                                : CHUNK_TILES;
+    pool->freeTiles = realloc(pool->freeTiles, sizeof(Obdn_V_BufferRegion) *
+                                                   pool->freeCapacity);
+    assert(pool->freeTiles);
+}
+
+// requests a chunk and puts its tiles on the free list, the first one last
+// so it is handed out first
+static void
+addChunk(Dali_TilePool* pool)
+{
+    if (pool->chunkCount == pool->chunkCapacity)
+    {
+        pool->chunkCapacity = pool->chunkCapacity ? pool->chunkCapacity * 2 : 8;
+        pool->chunks =
+            realloc(pool->chunks, sizeof(Dali_TileChunk) * pool->chunkCapacity);
+        assert(pool->chunks);
+    }
+    Dali_TileChunk* chunk = &pool->chunks[pool->chunkCount++];
+    chunk->region         = obdn_RequestBufferRegion(
+        pool->memory, pool->tileSize * CHUNK_TILES,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        OBDN_V_MEMORY_HOST_GRAPHICS_TYPE);
+    chunk->useCount = 0;
+
+    reserveFreeTiles(pool, pool->freeCount + CHUNK_TILES);
+    for (int i = CHUNK_TILES - 1; i >= 0; i--)
+    {
+        Obdn_V_BufferRegion tile = chunk->region;
+        tile.size                = pool->tileSize;
+        tile.offset             += i * pool->tileSize;
+        tile.hostData           += i * pool->tileSize;
+        pool->freeTiles[pool->freeCount++] = tile;
+    }
+}
+
+static uint32_t
+findChunk(const Dali_TilePool* pool, const Obdn_V_BufferRegion* tile)
+{
+    for (uint32_t c = 0; c < pool->chunkCount; c++)
+    {
+        const Obdn_V_BufferRegion* region = &pool->chunks[c].region;
+        if (tile->hostData >= region->hostData &&
+            tile->hostData < region->hostData + region->size)
+            return c;
+    }
+    assert(0 && "tile is not from this pool");
+    return 0;
+}
+
+// takes the chunk's tiles off the free list and gives it back to the memory
+static void
+dropChunk(Dali_TilePool* pool, const uint32_t c)
+{
+    const uint8_t* begin = pool->chunks[c].region.hostData;
+    const uint8_t* end   = begin + pool->chunks[c].region.size;
+    uint32_t       kept  = 0;
+    for (uint32_t i = 0; i < pool->freeCount; i++)
+    {
+        const uint8_t* data = pool->freeTiles[i].hostData;
+        if (data < begin || data >= end)
+            pool->freeTiles[kept++] = pool->freeTiles[i];
+    }
+    pool->freeCount = kept;
+    obdn_FreeBufferRegion(&pool->chunks[c].region);
+    pool->chunks[c] = pool->chunks[--pool->chunkCount];
+}
+
+Obdn_V_BufferRegion
+dali_AllocTile(Dali_TilePool* pool)
+{
+    if (pool->freeCount == 0)
+        addChunk(pool);
+    const Obdn_V_BufferRegion tile = pool->freeTiles[--pool->freeCount];
+    pool->chunks[findChunk(pool, &tile)].useCount++;
+    return tile;
+}
+
+void
+dali_FreeTile(Dali_TilePool* pool, Obdn_V_BufferRegion* tile)
+{
+    assert(tile->size == pool->tileSize);
+    const uint32_t c = findChunk(pool, tile);
+    reserveFreeTiles(pool, pool->freeCount + 1);
+    pool->freeTiles[pool->freeCount++] = *tile;
+    memset(tile, 0, sizeof(*tile));
+    assert(pool->chunks[c].useCount > 0);
+    if (--pool->chunks[c].useCount > 0)
+        return;
+    // one empty chunk is kept, so a tile freed and allocated again does not
+    // drop and request a chunk each time
+    for (uint32_t e = 0; e < pool->chunkCount; e++)
+    {
+        if (e != c && pool->chunks[e].useCount == 0)
+        {
+            dropChunk(pool, e);
+            return;
+        }
+    }
+}
+
+void
+dali_DestroyTilePool(Dali_TilePool* pool)
+{
+    for (uint32_t c = 0; c < pool->chunkCount; c++)
+        obdn_FreeBufferRegion(&pool->chunks[c].region);
+    free(pool->chunks);
+    free(pool->freeTiles);
+    memset(pool, 0, sizeof(*pool));
+}
+
+VkDeviceSize
+dali_GetTilePoolMemoryUsage(const Dali_TilePool* pool)
+{
+    VkDeviceSize size = 0;
+    for (uint32_t c = 0; c < pool->chunkCount; c++)
+        size += pool->chunks[c].region.size;
+    return size;
+}
@@ -0,0 +1,42 @@
+#ifndef DALI_TILEPOOL_H
+#define DALI_TILEPOOL_H
+
+#include <obsidian/memory.h>
+
+// the host tiles of a layer stack and of its undo history. tiles are carved
+// out of chunks requested from the Obdn_Memory a few at a time, rather than
+// each being a region of its own. freed tiles are handed out again before the
+// pool grows, and chunks go back to the memory once none of their tiles are
+// in use, all but one spare. a tile is a region like any other, but it must
+// only be freed here.
+
+typedef struct Dali_TileChunk {
+    Obdn_V_BufferRegion region;
+    uint32_t            useCount; // tiles handed out of it
+} Dali_TileChunk;
+
+typedef struct Dali_TilePool {
+    Obdn_Memory*         memory;
+    VkDeviceSize         tileSize;
+    Dali_TileChunk*      chunks;
+    uint32_t             chunkCount;
+    uint32_t             chunkCapacity; // chunks has room for this many
+    Obdn_V_BufferRegion* freeTiles;
+    uint32_t             freeCount;
+    uint32_t             freeCapacity; // freeTiles has room for this many
+} Dali_TilePool;
+
+// starts out with no chunks
+void dali_CreateTilePool(Obdn_Memory* memory, const VkDeviceSize tileSize,
+                         Dali_TilePool* pool);
+// returns a tile that can be a transfer source and destination. its contents
+// are whatever it last held.
+Obdn_V_BufferRegion dali_AllocTile(Dali_TilePool* pool);
+// takes the tile back and zeroes the region
+void dali_FreeTile(Dali_TilePool* pool, Obdn_V_BufferRegion* tile);
+// frees every chunk, along with any tile still handed out of it
+void dali_DestroyTilePool(Dali_TilePool* pool);
+// bytes of host memory the chunks take up, in use or not
+VkDeviceSize dali_GetTilePoolMemoryUsage(const Dali_TilePool* pool);
+
+#endif /* end of include guard: DALI_TILEPOOL_H */
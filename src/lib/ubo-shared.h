@@ -19,3 +19,24 @@ typedef struct {
     float anti_falloff;
 } UboBrush;
 
+
+// the image already holds a run of layers blended together, premultiplied
+#define COMP_LAYER_FLATTENED_BIT 1
+
+// an entry in the composite's layer table, see composite.comp
+typedef struct {
+    uint32_t image; // into the composite's image array, 0 is the active layer
+    float    opacity;
+    uint32_t blendMode;
+    uint32_t flags;
+    uint32_t occupancy; // its row in the composite's tile occupancy
+    uint32_t pad[3];
+} CompLayer;
+
+// the run of layer table entries one composite dispatch blends
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+    uint32_t accumulate; // onto what the previous dispatch wrote
+    uint32_t target;     // into the composite's storage images, 0 is imageA
+} CompBatch;
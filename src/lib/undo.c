@@ -6,139 +6,349 @@
 #include <hell/debug.h>
 #include <hell/common.h>
 #include <string.h>
+#include <stdlib.h>
+#ifdef UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
+typedef Dali_UndoManager UndoManager;
+typedef Dali_UndoEntry   UndoEntry;
 
+static void openSpillFile(UndoManager* undo, const char* path, const VkDeviceSize size)
+{
+#ifdef UNIX
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+    {
+        hell_Print("Undo: could not open spill file %s\n", path);
+        return;
+    }
+    if (ftruncate(fd, size) == 0)
+    {
+        void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            undo->spillData = data;
+            undo->spillSize = size;
+        }
+    }
+    // the mapping keeps the file alive, and nothing should outlive us
+    close(fd);
+    unlink(path);
+    if (!undo->spillData)
+        hell_Print("Undo: could not map spill file %s\n", path);
+#else
+    hell_Print("Undo: spilling to disk is not supported on this platform\n");
+#endif
+}
 
-typedef Dali_UndoManager UndoManager;
+static void closeSpillFile(UndoManager* undo)
+{
+#ifdef UNIX
+    if (undo->spillData)
+        munmap(undo->spillData, undo->spillSize);
+#endif
+    undo->spillData = NULL;
+    undo->spillSize = 0;
+}
 
-static void createStack(Obdn_Memory* memory, UndoManager* undo, const uint8_t index, const uint32_t size)
+static void growEntries(UndoEntry** entries, const uint32_t count, uint32_t* capacity)
 {
-    undo->undoStacks[index].cur = 0;
-    undo->undoStacks[index].trl = 0;
-    for (int i = 0; i < undo->maxUndos; i++) 
+    if (count < *capacity)
+        return;
+    *capacity = *capacity ? *capacity * 2 : 64;
+    *entries = realloc(*entries, sizeof(UndoEntry) * *capacity);
+    assert(*entries);
+}
+
+// an entry's tiles change hands on undo and redo, so its size does too
+static void recountEntry(UndoEntry* entry)
+{
+    entry->size = 0;
+    for (uint32_t i = 0; i < entry->tileCount; i++)
     {
-        undo->undoStacks[index].bufferRegions[i] = obdn_RequestBufferRegion(memory, size, 
-                VK_BUFFER_USAGE_TRANSFER_DST_BIT, OBDN_V_MEMORY_HOST_TRANSFER_TYPE);
+        entry->tiles[i].empty = entry->tiles[i].region.size == 0;
+        entry->size += entry->tiles[i].region.size;
     }
 }
 
-static void onLayerChange(UndoManager* undo, L_LayerId newLayerId)
+static void dropOldestEntry(UndoManager* undo)
+{
+    assert(undo->entryCount > 0);
+    UndoEntry* entry = &undo->entries[0];
+    if (entry->spilled)
+        undo->spilledCount--;
+    else
+        undo->residentSize -= entry->size;
+    dali_FreeUndoEntry(undo, entry);
+    undo->entryCount--;
+    memmove(undo->entries, undo->entries + 1, sizeof(UndoEntry) * undo->entryCount);
+}
+
+// finds room for size bytes after the newest spilled entry without
+// overwriting the oldest one
+static bool spillFits(const UndoManager* undo, const VkDeviceSize size, VkDeviceSize* offset)
 {
-    uint8_t highestLRUCounter = 0;
-    uint8_t leastRecentlyUsedStack = 0;
-    bool    layerInCache = false;
-    for (int i = 0; i < undo->maxStacks; i++) 
+    const UndoEntry* oldest = NULL;
+    for (uint32_t i = 0; i < undo->spilledCount && !oldest; i++)
     {
-        if (undo->layerCache[i] == newLayerId)
-        {
-            undo->curStackIndex = i;
-            layerInCache = true;
-        }
-        else
+        if (undo->entries[i].size)
+            oldest = &undo->entries[i];
+    }
+    if (!oldest)
+    {
+        *offset = 0;
+        return size <= undo->spillSize;
+    }
+    const VkDeviceSize head = oldest->spillOffset;
+    if (undo->spillTail > head)
+    {
+        if (undo->spillTail + size <= undo->spillSize)
         {
-            undo->stackNotUsedCounters[i]++;
-            if (undo->stackNotUsedCounters[i] > highestLRUCounter)
-            {
-                highestLRUCounter = undo->stackNotUsedCounters[i];
-                leastRecentlyUsedStack = i;
-            }
+            *offset = undo->spillTail;
+            return true;
         }
+        *offset = 0;
+        return size <= head;
+    }
+    *offset = undo->spillTail;
+    return undo->spillTail + size <= head;
+}
+
+// moves the oldest entry still in host memory into the spill file, dropping
+// older spilled entries to make room. returns false if it had to be dropped.
+static bool spillOldestResident(UndoManager* undo)
+{
+    UndoEntry* entry = &undo->entries[undo->spilledCount];
+    if (entry->size > undo->spillSize)
+    {
+        // everything older goes with it so history stays contiguous
+        const uint32_t count = undo->spilledCount + 1;
+        for (uint32_t i = 0; i < count; i++)
+            dropOldestEntry(undo);
+        return false;
     }
-    if (!layerInCache)
+    VkDeviceSize offset;
+    while (!spillFits(undo, entry->size, &offset))
     {
-        undo->curStackIndex = leastRecentlyUsedStack;
-        undo->layerCache[undo->curStackIndex] = newLayerId; 
-        undo->undoStacks[undo->curStackIndex].cur = undo->undoStacks[undo->curStackIndex].trl;
+        dropOldestEntry(undo);
+        entry = &undo->entries[undo->spilledCount];
     }
-    undo->stackNotUsedCounters[undo->curStackIndex] = 0;
-    assert(undo->curStackIndex < undo->maxStacks);
+    entry->spillOffset = offset;
+    for (uint32_t i = 0; i < entry->tileCount; i++)
+    {
+        UndoTile* tile = &entry->tiles[i];
+        if (tile->empty)
+            continue;
+        memcpy(undo->spillData + offset, tile->region.hostData, tile->region.size);
+        offset += tile->region.size;
+        dali_FreeTile(undo->tilePool, &tile->region);
+    }
+    entry->spilled = true;
+    undo->spillTail = offset;
+    undo->residentSize -= entry->size;
+    undo->spilledCount++;
+    hell_DebugPrint(PAINT_DEBUG_TAG_UNDO, "spilled entry of %ld bytes\n", (long)entry->size);
+    return true;
 }
 
-void dali_CreateUndoManager(Obdn_Memory* memory, const uint32_t size, const uint8_t maxStacks_, const uint8_t maxUndos_, UndoManager* undo)
+static void unspill(UndoManager* undo, UndoEntry* entry)
 {
-    assert(memory);
-    assert(undo);
-    assert(maxStacks_ > 0 && maxStacks_ <= MAX_STACKS);
-    assert(maxUndos_ > 0 && maxUndos_  <= MAX_UNDOS);
-    assert(maxUndos_ % 2 == 0);
-    memset(undo, 0, sizeof(UndoManager));
-    undo->maxStacks = maxStacks_;
-    undo->maxUndos = maxUndos_;
-    undo->curStackIndex = 0;
-    for (int i = 0; i < undo->maxStacks; i++) 
+    assert(entry->spilled);
+    VkDeviceSize offset = entry->spillOffset;
+    for (uint32_t i = 0; i < entry->tileCount; i++)
     {
-        undo->layerCache[i] = 0;
-        createStack(memory, undo, i, size);
+        UndoTile* tile = &entry->tiles[i];
+        if (tile->empty)
+            continue;
+        tile->region = dali_AllocTile(undo->tilePool);
+        memcpy(tile->region.hostData, undo->spillData + offset, undo->tileSize);
+        offset += undo->tileSize;
     }
+    entry->spilled = false;
+    undo->spillTail = entry->spillOffset; // it was the newest spilled entry
+    undo->spilledCount--;
+}
 
-    onLayerChange(undo, 0);
+static void enforceBudget(UndoManager* undo)
+{
+    // the newest entry is always kept, however large
+    while (undo->residentSize > undo->memoryBudget && undo->spilledCount + 1 < undo->entryCount)
+    {
+        if (undo->spillData)
+            spillOldestResident(undo);
+        else
+            dropOldestEntry(undo);
+    }
+}
+
+void dali_CreateUndoManager(Dali_LayerStack* stack, const VkDeviceSize memoryBudget, const char* spillPath, const VkDeviceSize spillBudget, UndoManager* undo)
+{
+    assert(stack);
+    assert(undo);
+    memset(undo, 0, sizeof(UndoManager));
+    undo->tilePool = &stack->tilePool;
+    undo->memoryBudget = memoryBudget;
+    if (spillPath && spillBudget)
+        openSpillFile(undo, spillPath, spillBudget);
 }
 
 void dali_DestroyUndoManager(UndoManager* undo)
 {
-    for (int i = 0; i < undo->maxStacks; i++)
+    assert(!undo->recording);
+    for (uint32_t i = 0; i < undo->entryCount; i++)
+        dali_FreeUndoEntry(undo, &undo->entries[i]);
+    free(undo->entries);
+    dali_ClearRedo(undo);
+    free(undo->redoEntries);
+    closeSpillFile(undo);
+    memset(undo, 0, sizeof(UndoManager));
+}
+
+void dali_BeginUndoEntry(UndoManager* undo, const L_LayerId layer)
+{
+    assert(!undo->recording);
+    growEntries(&undo->entries, undo->entryCount, &undo->entryCapacity);
+    UndoEntry* entry = &undo->entries[undo->entryCount];
+    memset(entry, 0, sizeof(UndoEntry));
+    entry->layer = layer;
+    undo->recording = true;
+}
+
+void dali_RecordUndoTile(UndoManager* undo, const uint32_t tile, const Obdn_V_BufferRegion* region)
+{
+    assert(undo->recording);
+    UndoEntry* entry = &undo->entries[undo->entryCount];
+    if (entry->tileCount == entry->tileCapacity)
     {
-        for (int j = 0; j < undo->maxUndos; j++)
-        {
-            obdn_FreeBufferRegion(&undo->undoStacks[i].bufferRegions[j]);
-        }
+        entry->tileCapacity = entry->tileCapacity ? entry->tileCapacity * 2 : 16;
+        entry->tiles = realloc(entry->tiles, sizeof(UndoTile) * entry->tileCapacity);
+        assert(entry->tiles);
     }
-    memset(undo, 0, sizeof(UndoManager));
+    if (region->size)
+    {
+        assert(undo->tileSize == 0 || undo->tileSize == region->size);
+        undo->tileSize = region->size;
+    }
+    entry->tiles[entry->tileCount].index  = tile;
+    entry->tiles[entry->tileCount].empty  = region->size == 0;
+    entry->tiles[entry->tileCount].region = *region;
+    entry->tileCount++;
+    entry->size += region->size;
 }
 
-Obdn_V_BufferRegion* dali_GetNextUndoBuffer(UndoManager* undo)
+void dali_EndUndoEntry(UndoManager* undo)
 {
-    UndoStack* undoStack = &undo->undoStacks[undo->curStackIndex];
-    const uint8_t stackIndex = undoStack->cur;
-    undoStack->cur = (undoStack->cur + 1) % undo->maxUndos;
-    if (undoStack->cur == undoStack->trl)
+    assert(undo->recording);
+    undo->recording = false;
+    UndoEntry* entry = &undo->entries[undo->entryCount];
+    if (entry->tileCount == 0)
     {
-        undoStack->trl++;
-        undoStack->trl = undoStack->trl % undo->maxUndos;
+        free(entry->tiles);
+        return;
     }
-    hell_DebugPrint(PAINT_DEBUG_TAG_UNDO, "cur: %d\n", undoStack->cur);
-    return &undoStack->bufferRegions[stackIndex];
+    undo->entryCount++;
+    undo->residentSize += entry->size;
+    hell_DebugPrint(PAINT_DEBUG_TAG_UNDO, "entry recorded with %d tiles. %d entries\n", entry->tileCount, undo->entryCount);
+    enforceBudget(undo);
 }
 
-Obdn_V_BufferRegion* dali_GetLastUndoBuffer(UndoManager* undo)
+bool dali_PopUndoEntry(UndoManager* undo, UndoEntry* entry)
 {
-    UndoStack* undoStack = &undo->undoStacks[undo->curStackIndex];
-    uint8_t stackIndex = undoStack->cur - 1;
-    if (stackIndex % undo->maxUndos == undoStack->trl)
+    assert(!undo->recording);
+    if (undo->entryCount == 0)
     {
         hell_Print("Nothing to undo!\n");
-        return NULL; // cannot cross trl
+        return false;
+    }
+    UndoEntry* last = &undo->entries[undo->entryCount - 1];
+    if (last->spilled)
+        unspill(undo, last);
+    else
+        undo->residentSize -= last->size;
+    *entry = *last;
+    undo->entryCount--;
+    hell_DebugPrint(PAINT_DEBUG_TAG_UNDO, "entries: %d\n", undo->entryCount);
+    return true;
+}
+
+void dali_PushUndoEntry(UndoManager* undo, const UndoEntry* entry)
+{
+    assert(!undo->recording);
+    growEntries(&undo->entries, undo->entryCount, &undo->entryCapacity);
+    UndoEntry* last = &undo->entries[undo->entryCount++];
+    *last = *entry;
+    recountEntry(last);
+    undo->residentSize += last->size;
+    enforceBudget(undo);
+}
+
+void dali_PushRedoEntry(UndoManager* undo, const UndoEntry* entry)
+{
+    growEntries(&undo->redoEntries, undo->redoCount, &undo->redoCapacity);
+    UndoEntry* last = &undo->redoEntries[undo->redoCount++];
+    *last = *entry;
+    recountEntry(last);
+    undo->residentSize += last->size;
+}
+
+bool dali_PopRedoEntry(UndoManager* undo, UndoEntry* entry)
+{
+    if (undo->redoCount == 0)
+    {
+        hell_Print("Nothing to redo!\n");
+        return false;
     }
-    stackIndex--;
-    stackIndex = stackIndex % undo->maxUndos;
-    hell_DebugPrint(PAINT_DEBUG_TAG_UNDO, "undoStack->cur - 1 = %d\n", undoStack->cur - 1);
-    undoStack->cur--;
-    undoStack->cur = undoStack->cur % undo->maxUndos;
-    hell_DebugPrint(PAINT_DEBUG_TAG_UNDO, "cur: %d\n", undoStack->cur);
-    return &undoStack->bufferRegions[stackIndex];
+    *entry = undo->redoEntries[--undo->redoCount];
+    undo->residentSize -= entry->size;
+    hell_DebugPrint(PAINT_DEBUG_TAG_UNDO, "redo entries: %d\n", undo->redoCount);
+    return true;
 }
 
-bool dali_LayerInUndoCache(UndoManager* undo, L_LayerId layer)
+void dali_ClearRedo(UndoManager* undo)
 {
-    for (int i = 0; i < undo->maxStacks; i++)
+    for (uint32_t i = 0; i < undo->redoCount; i++)
     {
-        if (undo->layerCache[i] == layer)
-            return true;
+        undo->residentSize -= undo->redoEntries[i].size;
+        dali_FreeUndoEntry(undo, &undo->redoEntries[i]);
     }
-    return false;
+    undo->redoCount = 0;
 }
 
-void dali_UpdateUndo(UndoManager* undo, Dali_LayerStack* layerStack)
+void dali_FreeUndoEntry(UndoManager* undo, UndoEntry* entry)
 {
-    if (layerStack->dirt & LAYER_CHANGED_BIT)
+    for (uint32_t i = 0; i < entry->tileCount; i++)
     {
-        if (!dali_LayerInUndoCache(undo, layerStack->activeLayer))
-            layerStack->dirt |= LAYER_BACKUP_BIT;
-        onLayerChange(undo, layerStack->activeLayer);
+        if (entry->tiles[i].region.size)
+            dali_FreeTile(undo->tilePool, &entry->tiles[i].region);
     }
+    free(entry->tiles);
+    memset(entry, 0, sizeof(UndoEntry));
+}
+
+VkDeviceSize dali_GetUndoMemoryUsage(const UndoManager* undo)
+{
+    return undo->residentSize;
+}
+
+void dali_Undo(UndoManager* undo)
+{
+    undo->dirt |= UNDO_BIT;
+}
+
+void dali_Redo(UndoManager* undo)
+{
+    undo->dirt |= REDO_BIT;
 }
 
 Dali_UndoManager* dali_AllocUndo(void)
 {
     return hell_Malloc(sizeof(Dali_UndoManager));
 }
+
+void dali_UndoClearDirt(UndoManager* undo)
+{
+    undo->dirt = 0;
+}
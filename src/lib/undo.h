@@ -6,18 +6,45 @@
 
 typedef uint32_t Dali_DirtMask;
 typedef struct Dali_UndoManager Dali_UndoManager;
+typedef struct Dali_UndoEntry Dali_UndoEntry;
 
-void dali_CreateUndoManager(Obdn_Memory* memory, const uint32_t size, const uint8_t maxStacks_, const uint8_t maxUndos_, Dali_UndoManager* undo);
+// keeps a single history of strokes across all layers. an entry only holds the
+// tiles its stroke modified. once the tile data in history exceeds
+// memoryBudget bytes the oldest entries are dropped, or, if spillPath is given,
+// moved to a file of up to spillBudget bytes mapped at that path. its tiles
+// come from the stack's, which must outlive it.
+void dali_CreateUndoManager(Dali_LayerStack* stack, const VkDeviceSize memoryBudget, const char* spillPath /* optional */, const VkDeviceSize spillBudget, Dali_UndoManager* undo);
 
 void dali_DestroyUndoManager(Dali_UndoManager* undo);
 
-Obdn_V_BufferRegion* dali_GetNextUndoBuffer(Dali_UndoManager* undo);
-
-Obdn_V_BufferRegion* dali_GetLastUndoBuffer(Dali_UndoManager* undo);
-
-bool dali_LayerInUndoCache(Dali_UndoManager* undo, Dali_LayerId layer);
+// an entry is recorded as the pre-stroke contents of each tile the stroke
+// touched. the manager takes ownership of the recorded regions.
+void dali_BeginUndoEntry(Dali_UndoManager* undo, const Dali_LayerId layer);
+void dali_RecordUndoTile(Dali_UndoManager* undo, const uint32_t tile, const Obdn_V_BufferRegion* region);
+void dali_EndUndoEntry(Dali_UndoManager* undo);
+
+// removes the most recent entry and hands it to the caller, reading it back
+// from the spill file if needed. returns false if there is nothing to undo.
+bool dali_PopUndoEntry(Dali_UndoManager* undo, Dali_UndoEntry* entry);
+// hands a popped entry back to history, e.g. once it has been redone
+void dali_PushUndoEntry(Dali_UndoManager* undo, const Dali_UndoEntry* entry);
+// undone entries wait here, holding the tiles they replaced, until they are
+// redone or new paint clears them
+void dali_PushRedoEntry(Dali_UndoManager* undo, const Dali_UndoEntry* entry);
+bool dali_PopRedoEntry(Dali_UndoManager* undo, Dali_UndoEntry* entry);
+void dali_ClearRedo(Dali_UndoManager* undo);
+// frees every region still in the entry. zero the regions you have taken.
+void dali_FreeUndoEntry(Dali_UndoManager* undo, Dali_UndoEntry* entry);
+
+// bytes of tile data history holds in host memory
+VkDeviceSize dali_GetUndoMemoryUsage(const Dali_UndoManager* undo);
+
+// request that the last stroke be undone, whichever layer it was on
+void dali_Undo(Dali_UndoManager* undo);
+// request that the last undone stroke be restored
+void dali_Redo(Dali_UndoManager* undo);
 
 Dali_UndoManager* dali_AllocUndo(void);
-void dali_UpdateUndo(Dali_UndoManager* undo, Dali_LayerStack* layerStack);
+void dali_UndoClearDirt(Dali_UndoManager* undo);
 
 #endif /* end of include guard: UNDO_H */
@@ -0,0 +1,10 @@
+#version 460
+
+layout(location = 0) in  vec2 inUv;
+
+layout(location = 0) out uvec4 outColor;
+
+void main()
+{
+    outColor = uvec4(0);
+}
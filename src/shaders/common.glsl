@@ -1,3 +1,5 @@
+#define TILE_SIZE 256 // must match DALI_TILE_SIZE
+
 vec4 over(const vec4 a, const vec4 b)
 {
     //const vec3 color = a.rgb * a.a + b.rgb * b.a * (1. - a.a);
@@ -0,0 +1,26 @@
+#version 460
+
+layout(location = 0) out vec2 outUV;
+
+layout(set = 1, binding = 2, r32ui) uniform readonly uimage2D image;
+
+// texel bounds of what the frame's dabs wrote, see paint.rgen
+layout(set = 1, binding = 5) readonly buffer DabBounds {
+    ivec4 bounds[];
+} dabBounds;
+
+// vertex ordering is clockwise
+const vec2 corners[6] = vec2[](
+    vec2(0, 0), vec2(1, 0), vec2(0, 1),
+    vec2(1, 0), vec2(1, 1), vec2(0, 1));
+
+// two triangles over just the texels the dabs wrote. collapses to nothing if
+// every dab missed.
+void main()
+{
+    const ivec4 b  = dabBounds.bounds[0];
+    const vec2  lo = vec2(b.xy);
+    const vec2  hi = b.z < b.x ? lo : vec2(b.zw + 1);
+    outUV = mix(lo, hi, corners[gl_VertexIndex]) / vec2(imageSize(image));
+    gl_Position = vec4(outUV * 2.0f + -1.0f, 0.0f, 1.0f);
+}
@@ -2,14 +2,19 @@
 #extension GL_GOOGLE_include_directive : enable
 
 #include "common.glsl"
+#include "brush.glsl"
 
 layout(location = 0) in  vec2 inUv;
 
 layout(location = 0) out vec4 outColor;
 
-layout (input_attachment_index = 0, set = 2, binding = 0) uniform subpassInput inputA;
+layout(set = 1, binding = 1) uniform Block {
+    Brush brush;
+};
+
+layout (input_attachment_index = 0, set = 2, binding = 0) uniform usubpassInput inputStamp;
 
 void main()
 {
-    outColor = subpassLoad(inputA);
+    outColor = vec4(brush.r, brush.g, brush.b, uintBitsToFloat(subpassLoad(inputStamp).r));
 }